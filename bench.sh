@@ -0,0 +1,35 @@
+# bench.sh
+# @bingxio - https://drift-lang.fun/
+#
+# Times lexing of sources made by gen.sh with a drift built by build.sh.
+# Tokens are printed to /dev/null, so the time includes formatting them.
+#   ./bench.sh [MB ...]    default: 1 5 20
+DRIFT=${DRIFT:-./drift}
+DIR=`mktemp -d`
+trap 'rm -rf $DIR' EXIT
+
+if [ ! -x $DRIFT ]; then
+	echo "no $DRIFT, run build.sh first"
+	exit;
+fi
+
+SIZES=${@:-1 5 20}
+
+# Milliseconds taken by the drift command given.
+run() {
+	local s=`date +%s%N`
+	$DRIFT "$@" > /dev/null
+	local e=`date +%s%N`
+	echo $(((e - s) / 1000000))
+}
+
+for mb in $SIZES; do
+	f=$DIR/bench_$mb.ft
+	`dirname $0`/gen.sh $mb > $f
+	for mode in "" split; do
+		ms=`run $f token $mode`
+		[ $ms -eq 0 ] && ms=1
+		printf "%4s MB %-6s %6d ms %8d KB/s\n" $mb "$mode" $ms \
+			$((mb * 1024 * 1000 / ms))
+	done
+done
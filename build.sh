@@ -26,7 +26,7 @@ for f in `ls ./src/*.c`; do
 done
 echo $OUT
 
-$CC $BUG $OUT -W -ldl -o drift
+$CC $BUG $OUT -W -ldl -lpthread -o drift
 
 rm -f *.o
 echo "Done!"
@@ -0,0 +1,39 @@
+# gen.sh
+# @bingxio - https://drift-lang.fun/
+#
+# Writes a generated source of about the given megabytes to stdout, for
+# timing the lexer: ./gen.sh 5 > big.ft
+# It is a whole program that compiles and runs, printing 0, so it also
+# times the compiler: ./drift big.ft
+MB=${1:-5}
+
+awk -v size=$((MB * 1024 * 1024)) '
+function name(i,    s) {
+	s = ""
+	do {
+		s = sprintf("%c", 97 + i % 26) s
+		i = int(i / 26)
+	} while (i > 0)
+	return "v" s
+}
+BEGIN {
+	n = 0
+	out = 0
+	while (out < size) {
+		a = name(n)
+		b = name(n + 1)
+		line = "# rule " n "\n"
+		line = line "def " a " int = " n " * 3 + (" n % 7 " - 2) / 1\n"
+		line = line "def " b " string = \"rule-" n "\"\n"
+		line = line "if " a " > " n * 2 " & " a " != 0\n"
+		line = line "  " a " = " a " - 1\n"
+		line = line "ef " a " <= 0 | " b " == \"\"\n"
+		line = line "  " a " = 0\n"
+		line = line "nf\n"
+		line = line "  " a " = " a " + 1\n"
+		printf "%s", line
+		out += length(line)
+		n += 2
+	}
+	print "println(" name(0) ")"
+}'
@@ -0,0 +1,569 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cache.h"
+#include "object.h"
+#include "optimize.h"
+#include "pool.h"
+#include "type.h"
+#include "verify.h"
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CACHE_MMAP
+#endif
+
+#define CACHE_ORDER 0x01020304
+
+typedef struct {
+  uint8_t* data;
+  int len;
+  int cap;
+} writer;
+
+typedef struct {
+  uint8_t* data;
+  int len;
+  int p;
+  bool bad;
+} reader;
+
+static void put(writer* w, const void* ptr, int n) {
+  while (w->len + n > w->cap) {
+    w->cap = w->cap == 0 ? 256 : w->cap * 2;
+    w->data = realloc(w->data, w->cap);
+  }
+  memcpy(w->data + w->len, ptr, n);
+  w->len += n;
+}
+
+static void put_byte(writer* w, uint8_t b) {
+  put(w, &b, sizeof(uint8_t));
+}
+
+static void put_int(writer* w, int32_t i) {
+  put(w, &i, sizeof(int32_t));
+}
+
+static void put_long(writer* w, int64_t i) {
+  put(w, &i, sizeof(int64_t));
+}
+
+static void put_str(writer* w, const char* str) {
+  if (str == NULL) {
+    put_int(w, -1);
+    return;
+  }
+  int len = strlen(str);
+  put_int(w, len);
+  put(w, str, len + 1);
+}
+
+static void put_strs(writer* w, keg* g) {
+  put_int(w, g == NULL ? -1 : g->item);
+  for (int i = 0; g != NULL && i < g->item; i++) {
+    put_str(w, g->data[i]);
+  }
+}
+
+static void put_type(writer*, type*);
+
+static void put_types(writer* w, keg* g) {
+  put_int(w, g == NULL ? -1 : g->item);
+  for (int i = 0; g != NULL && i < g->item; i++) {
+    put_type(w, g->data[i]);
+  }
+}
+
+static void put_type(writer* w, type* t) {
+  if (t == NULL) {
+    put_byte(w, UINT8_MAX);
+    return;
+  }
+  put_byte(w, t->kind);
+  switch (t->kind) {
+    case T_ARRAY:
+    case T_TUPLE:
+      put_type(w, (type*)t->inner.single);
+      break;
+    case T_MAP:
+      put_type(w, (type*)t->inner.both.T1);
+      put_type(w, (type*)t->inner.both.T2);
+      break;
+    case T_FUNCTION:
+      put_types(w, t->inner.fn.arg);
+      put_type(w, (type*)t->inner.fn.ret);
+      break;
+    case T_USER:
+      put_str(w, t->inner.name);
+      break;
+    case T_GENERIC: {
+      generic* g = (generic*)t->inner.ge;
+      put_str(w, g->name);
+      put_int(w, g->count);
+      if (g->count == 1) {
+        put_type(w, g->mtype.T);
+      } else if (g->count > 1) {
+        put_types(w, g->mtype.multiple);
+      }
+      break;
+    }
+  }
+}
+
+static void put_code(writer*, code_object*);
+
+static void put_object(writer* w, object* obj) {
+  put_byte(w, obj->kind);
+  switch (obj->kind) {
+    case OBJ_INT:
+      put_int(w, obj->value.num);
+      break;
+    case OBJ_FLOAT:
+      put(w, &obj->value.f, sizeof(double));
+      break;
+    case OBJ_STRING:
+      put_str(w, obj->value.str);
+      break;
+    case OBJ_CHAR:
+      put_byte(w, obj->value.c);
+      break;
+    case OBJ_BOOL:
+      put_byte(w, obj->value.b);
+      break;
+    case OBJ_ENUMERATE:
+      put_str(w, obj->value.en.name);
+      put_strs(w, obj->value.en.element);
+      break;
+    case OBJ_FUNCTION:
+      put_strs(w, obj->value.fn.k);
+      put_types(w, obj->value.fn.v);
+      put_type(w, obj->value.fn.mutiple);
+      put_type(w, obj->value.fn.ret);
+      put_types(w, obj->value.fn.gt);
+      put_code(w, obj->value.fn.code);
+      break;
+    case OBJ_CLASS:
+      put_types(w, obj->value.cl.gt);
+      put_code(w, obj->value.cl.code);
+      break;
+    case OBJ_INTERFACE: {
+      keg* elem = obj->value.in.element;
+      put_str(w, obj->value.in.name);
+      put_types(w, obj->value.in.gt);
+      put_int(w, elem == NULL ? -1 : elem->item);
+      for (int i = 0; elem != NULL && i < elem->item; i++) {
+        method* m = elem->data[i];
+        put_str(w, m->name);
+        put_types(w, m->arg);
+        put_type(w, m->ret);
+      }
+      break;
+    }
+    case OBJ_EBLOCK:
+      put_str(w, obj->value.eb.name);
+      put_code(w, obj->value.eb.code);
+      break;
+  }
+}
+
+static void put_code(writer* w, code_object* code) {
+  put_str(w, code->description);
+  put_strs(w, code->names);
+  put_strs(w, code->locals);
+  put_int(w, code->regs);
+  put_byte(w, code->typed);
+  put_int(w, code->sites);
+  put_types(w, code->types);
+  keg* objs = code->objects;
+  put_int(w, objs == NULL ? -1 : objs->item);
+  for (int i = 0; objs != NULL && i < objs->item; i++) {
+    put_object(w, objs->data[i]);
+  }
+  put_int(w, code->len);
+  put(w, code->codes, code->len);
+  put_int(w, code->count);
+  put_int(w, code->lines.len);
+  put(w, code->lines.data, code->lines.len);
+}
+
+static uint8_t* get(reader* r, int n) {
+  if (r->bad || n < 0 || r->p + n > r->len) {
+    r->bad = true;
+    return NULL;
+  }
+  uint8_t* ptr = r->data + r->p;
+  r->p += n;
+  return ptr;
+}
+
+static uint8_t get_byte(reader* r) {
+  uint8_t* ptr = get(r, sizeof(uint8_t));
+  return ptr == NULL ? 0 : *ptr;
+}
+
+static int32_t get_int(reader* r) {
+  int32_t i = 0;
+  uint8_t* ptr = get(r, sizeof(int32_t));
+  if (ptr != NULL) {
+    memcpy(&i, ptr, sizeof(int32_t));
+  }
+  return i;
+}
+
+static int64_t get_long(reader* r) {
+  int64_t i = 0;
+  uint8_t* ptr = get(r, sizeof(int64_t));
+  if (ptr != NULL) {
+    memcpy(&i, ptr, sizeof(int64_t));
+  }
+  return i;
+}
+
+/* Strings are used in place, the mapping stays alive for the whole run. */
+static char* get_str(reader* r) {
+  int len = get_int(r);
+  if (len == -1) {
+    return NULL;
+  }
+  char* str = (char*)get(r, len + 1);
+  if (str != NULL && str[len] != '\0') {
+    r->bad = true;
+  }
+  return r->bad ? NULL : str;
+}
+
+/* Counts of -1 stand for NULL. Every entry takes at least one byte, so a
+ * count past what is left of the file is damage and nothing is allocated
+ * for it. */
+static bool get_count(reader* r, int* n) {
+  *n = get_int(r);
+  if (*n < -1 || *n > r->len - r->p) {
+    r->bad = true;
+  }
+  return *n != -1 && !r->bad;
+}
+
+static keg* get_strs(reader* r) {
+  int n;
+  if (!get_count(r, &n)) {
+    return NULL;
+  }
+  keg* g = new_keg();
+  for (int i = 0; i < n && !r->bad; i++) {
+    g = append_keg(g, get_str(r));
+  }
+  return g;
+}
+
+static type* get_type(reader*);
+
+static keg* get_types(reader* r) {
+  int n;
+  if (!get_count(r, &n)) {
+    return NULL;
+  }
+  keg* g = new_keg();
+  for (int i = 0; i < n && !r->bad; i++) {
+    g = append_keg(g, get_type(r));
+  }
+  return g;
+}
+
+static type* get_type(reader* r) {
+  uint8_t kind = get_byte(r);
+  if (kind == UINT8_MAX || r->bad) {
+    return NULL;
+  }
+  if (kind > T_GENERIC) {
+    r->bad = true;
+    return NULL;
+  }
+  type* t = new_type(kind);
+  switch (kind) {
+    case T_ARRAY:
+    case T_TUPLE:
+      t->inner.single = (struct type*)get_type(r);
+      break;
+    case T_MAP:
+      t->inner.both.T1 = (struct type*)get_type(r);
+      t->inner.both.T2 = (struct type*)get_type(r);
+      break;
+    case T_FUNCTION:
+      t->inner.fn.arg = get_types(r);
+      t->inner.fn.ret = (struct type*)get_type(r);
+      break;
+    case T_USER:
+      t->inner.name = get_str(r);
+      break;
+    case T_GENERIC: {
+      generic* g = malloc(sizeof(generic));
+      g->name = get_str(r);
+      g->count = get_int(r);
+      if (g->count == 1) {
+        g->mtype.T = get_type(r);
+      } else if (g->count > 1) {
+        g->mtype.multiple = get_types(r);
+      }
+      t->inner.ge = (struct generic*)g;
+      break;
+    }
+  }
+  return t;
+}
+
+static code_object* get_code(reader*);
+
+static object* get_object(reader* r) {
+  uint8_t kind = get_byte(r);
+  if (r->bad) {
+    return NULL;
+  }
+  object* obj = calloc(1, sizeof(object));
+  obj->kind = kind;
+  switch (kind) {
+    case OBJ_INT:
+      obj->value.num = get_int(r);
+      break;
+    case OBJ_FLOAT: {
+      uint8_t* ptr = get(r, sizeof(double));
+      if (ptr != NULL) {
+        memcpy(&obj->value.f, ptr, sizeof(double));
+      }
+      break;
+    }
+    case OBJ_STRING:
+      obj->value.str = get_str(r);
+      break;
+    case OBJ_CHAR:
+      obj->value.c = get_byte(r);
+      break;
+    case OBJ_BOOL:
+      obj->value.b = get_byte(r);
+      break;
+    case OBJ_NIL:
+      break;
+    case OBJ_ENUMERATE:
+      obj->value.en.name = get_str(r);
+      obj->value.en.element = get_strs(r);
+      break;
+    case OBJ_FUNCTION:
+      obj->value.fn.k = get_strs(r);
+      obj->value.fn.v = get_types(r);
+      obj->value.fn.mutiple = get_type(r);
+      obj->value.fn.ret = get_type(r);
+      obj->value.fn.gt = get_types(r);
+      obj->value.fn.code = get_code(r);
+      obj->value.fn.self = NULL;
+      if (obj->value.fn.code != NULL) {
+        obj->value.fn.name = obj->value.fn.code->description;
+      }
+      break;
+    case OBJ_CLASS:
+      obj->value.cl.gt = get_types(r);
+      obj->value.cl.code = get_code(r);
+      obj->value.cl.fr = NULL;
+      obj->value.cl.init = false;
+      if (obj->value.cl.code != NULL) {
+        obj->value.cl.name = obj->value.cl.code->description;
+      }
+      break;
+    case OBJ_INTERFACE: {
+      obj->value.in.name = get_str(r);
+      obj->value.in.gt = get_types(r);
+      obj->value.in.class = NULL;
+      obj->value.in.element = NULL;
+      int n;
+      get_count(r, &n);
+      for (int i = 0; i < n && !r->bad; i++) {
+        method* m = malloc(sizeof(method));
+        m->name = get_str(r);
+        m->arg = get_types(r);
+        m->ret = get_type(r);
+        obj->value.in.element = append_keg(obj->value.in.element, m);
+      }
+      break;
+    }
+    case OBJ_EBLOCK:
+      obj->value.eb.name = get_str(r);
+      obj->value.eb.code = get_code(r);
+      break;
+    default:
+      r->bad = true;
+  }
+  return obj;
+}
+
+static code_object* get_code(reader* r) {
+  code_object* code = malloc(sizeof(code_object));
+  code->description = get_str(r);
+  code->names = get_strs(r);
+  code->locals = get_strs(r);
+  code->regs = get_int(r);
+  code->typed = get_byte(r);
+  code->sites = get_int(r);
+  code->ic = NULL;
+  code->mark = 0;
+  code->types = get_types(r);
+  code->objects = NULL;
+  int n;
+  if (get_count(r, &n)) {
+    code->objects = new_keg();
+  }
+  for (int i = 0; i < n && !r->bad; i++) {
+    code->objects = append_keg(code->objects, get_object(r));
+  }
+  code->len = get_int(r);
+  code->cap = code->len;
+  code->codes = get(r, code->len);
+  code->count = get_int(r);
+  code->stack = 0;
+  int len = get_int(r);
+  code->lines = (line_table){get(r, len), len, len, 0, 0};
+  return code;
+}
+
+#ifdef CACHE_MMAP
+/* Shares the literals and names of a loaded tree with the compiled ones.
+ * Only done once the whole file has been read, the pool must not keep
+ * pointers into a mapping that is dropped again. */
+static void pool_code(code_object* code) {
+  for (int i = 0; code->names != NULL && i < code->names->item; i++) {
+    code->names->data[i] = pool_name(code->names->data[i]);
+  }
+  for (int i = 0; code->objects != NULL && i < code->objects->item; i++) {
+    object* obj = pool_obj(code->objects->data[i]);
+    code->objects->data[i] = obj;
+    switch (obj->kind) {
+      case OBJ_FUNCTION:
+        pool_code(obj->value.fn.code);
+        break;
+      case OBJ_CLASS:
+        pool_code(obj->value.cl.code);
+        break;
+      case OBJ_EBLOCK:
+        pool_code(obj->value.eb.code);
+        break;
+    }
+  }
+}
+
+static char* cache_path(const char* path) {
+  char* cp = malloc(strlen(path) + 2);
+  sprintf(cp, "%sc", path);
+  return cp;
+}
+
+/* FNV-1a of the text a code object was compiled from. A cache is only
+ * used for the same text, whatever the file times say. */
+static uint64_t hash_source(const source* src) {
+  uint64_t h = 0xcbf29ce484222325u;
+  for (int i = 0; i < src->size; i++) {
+    h = (h ^ (uint8_t)src->buf[i]) * 0x100000001b3u;
+  }
+  return h;
+}
+
+static void put_header(writer* w, const source* src) {
+  put(w, CACHE_MAGIC, strlen(CACHE_MAGIC));
+  put_byte(w, CACHE_VERSION);
+  put_int(w, CACHE_ORDER);
+  put_byte(w, reg_mode);
+  put_byte(w, no_inline);
+  put_long(w, src->size);
+  put_long(w, (int64_t)hash_source(src));
+}
+
+static bool check_header(reader* r, const source* src) {
+  uint8_t* magic = get(r, strlen(CACHE_MAGIC));
+  if (magic == NULL || memcmp(magic, CACHE_MAGIC, strlen(CACHE_MAGIC)) != 0) {
+    return false;
+  }
+  if (get_byte(r) != CACHE_VERSION || get_int(r) != CACHE_ORDER) {
+    return false;
+  }
+  if (get_byte(r) != reg_mode || get_byte(r) != no_inline) {
+    return false;
+  }
+  /* The size is compared first, the text is only hashed when it agrees. */
+  if (get_long(r) != src->size ||
+      get_long(r) != (int64_t)hash_source(src)) {
+    return false;
+  }
+  return !r->bad;
+}
+#endif
+
+code_object* load_cache(const char* path) {
+#ifdef CACHE_MMAP
+  char* cp = cache_path(path);
+  int fd = open(cp, O_RDONLY);
+  free(cp);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  void* map =
+      mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  source src;
+  if (!open_source(path, &src)) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  reader r = {.data = map, .len = st.st_size, .p = 0, .bad = false};
+  code_object* code = NULL;
+  if (check_header(&r, &src)) {
+    code = get_code(&r);
+  }
+  close_source(&src);
+  /* The file may be damaged or made by hand, it runs only once checked. */
+  if (r.bad || code == NULL || !verify(code)) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  pool_code(code);
+  return code;
+#else
+  return NULL;
+#endif
+}
+
+void dump_cache(const char* path, const source* src, code_object* code) {
+#ifdef CACHE_MMAP
+  writer w = {.data = NULL, .len = 0, .cap = 0};
+  put_header(&w, src);
+  put_code(&w, code);
+
+  char* cp = cache_path(path);
+  char* tmp = malloc(strlen(cp) + 16);
+  sprintf(tmp, "%s.%d", cp, (int)getpid());
+
+  FILE* fp = fopen(tmp, "wb");
+  if (fp != NULL) {
+    bool ok = fwrite(w.data, sizeof(uint8_t), w.len, fp) == w.len;
+    if (fclose(fp) != 0 || !ok || rename(tmp, cp) != 0) {
+      remove(tmp);
+    }
+  }
+  free(tmp);
+  free(cp);
+  free(w.data);
+#endif
+}
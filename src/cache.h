@@ -0,0 +1,24 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#ifndef FT_CACHE_H
+#define FT_CACHE_H
+
+#include "code.h"
+#include "source.h"
+
+/* Bump whenever the opcode set, the operand layout or the serialized
+ * shape of code objects changes. */
+#define CACHE_VERSION 10
+#define CACHE_MAGIC "FTC"
+
+/* The code cached for the source at path, NULL unless it was compiled from
+ * the same text with the same options. */
+code_object* load_cache(const char*);
+
+/* Caches code next to path, src is the text it was compiled from. */
+void dump_cache(const char*, const source*, code_object*);
+
+#endif
@@ -6,16 +6,45 @@
 #ifndef FT_CODE_H
 #define FT_CODE_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "keg.h"
+#include "line.h"
+
+/* Operands are stored inline after their opcode as little-endian int16,
+ * jump targets as int32 so code objects of any size can be run. */
+#define READ_OFF(codes, p) (int16_t)((codes)[p] | (codes)[(p) + 1] << 8)
+#define READ_JUMP(codes, p)                                          \
+  (int32_t)((uint32_t)(codes)[p] | (uint32_t)(codes)[(p) + 1] << 8 | \
+            (uint32_t)(codes)[(p) + 2] << 16 |                       \
+            (uint32_t)(codes)[(p) + 3] << 24)
+
+/* Inline cache of a member access site: where the member was found last
+ * time. It is only a hint, the name there is compared before use. */
+typedef struct {
+  int index; /* in the table, enum or C module methods searched */
+  int inner; /* of the method of an interface or a C module variable */
+} inline_cache;
 
 typedef struct {
   char* description;
   keg* names;
-  keg* codes;
-  keg* offsets;
   keg* types;
   keg* objects;
-  keg* lines;
+  keg* locals; /* names of the frame slots, NULL when there are none */
+  int regs;    /* temporary registers that follow the slots */
+  bool typed;  /* every return value is proven to match the declared type */
+  uint8_t* codes;
+  int len;
+  int cap;
+  line_table lines;
+  int count; /* instructions */
+  int stack; /* deepest the operand stack gets, found by verify */
+  /* Inline caches of the member accesses, allocated when one first runs. */
+  inline_cache* ic;
+  int sites;
+  uint32_t mark; /* last collection that went through the constants */
 } code_object;
 
 #endif
\ No newline at end of file
@@ -10,170 +10,199 @@
 #include "keg.h"
 #include "object.h"
 #include "opcode.h"
+#include "optimize.h"
+#include "pool.h"
 #include "token.h"
 #include "trace.h"
 #include "type.h"
+#include "verify.h"
 
+extern token next_token(token_stream*);
+
+/* Everything a compilation works on, so several may run at once. */
 typedef struct {
-  keg* tokens;
+  token_stream* tokens;
+  token back; /* before pre */
   token pre;
   token cur;
-  int16_t iof;
-  int16_t inf;
-  int16_t itf;
-  int p;
+  int line;      /* of the statement, for the instructions emitted */
+  int name_line; /* of the name a definition emits next, -1 if none */
   bool loop;
   keg* codes;
+  bool ret;     /* the statement is the value of a return */
+  int nest;     /* blocks around the statement */
+  int kept;     /* values left by the statements at the top of the REPL */
+  uint8_t last; /* opcode emitted last */
 } compile_state;
 
 code_object* new_code(char* des) {
   code_object* code = malloc(sizeof(code_object));
   code->description = des;
   code->codes = NULL;
-  code->lines = NULL;
+  code->len = 0;
+  code->cap = 0;
+  code->lines = (line_table){NULL, 0, 0, 0, 0};
+  code->count = 0;
+  code->stack = 0;
   code->names = NULL;
   code->objects = NULL;
-  code->offsets = NULL;
   code->types = NULL;
+  code->locals = NULL;
+  code->regs = 0;
+  code->typed = false;
+  code->sites = 0;
+  code->ic = NULL;
+  code->mark = 0;
   return code;
 }
 
-compile_state cst;
-void block();
+void block(compile_state* cst);
 
-compile_state backup_state() {
+compile_state backup_state(compile_state* cst) {
   compile_state up;
-  up.iof = cst.iof;
-  up.inf = cst.inf;
-  up.itf = cst.itf;
-  up.p = cst.p;
+  up.back = cst->back;
   return up;
 }
 
 void reset_state(compile_state* state, compile_state up) {
-  state->iof = up.iof;
-  state->inf = up.inf;
-  state->itf = up.itf;
-  state->p = up.p;
+  state->back = up.back;
 }
 
-void clear_state() {
-  cst.iof = 0;
-  cst.inf = 0;
-  cst.itf = 0;
-}
+#define PUSH_CODE(code) cst->codes = append_keg(cst->codes, code)
+#define BACK_CODE (code_object*)back_keg(cst->codes)
 
-#define PUSH_CODE(code) cst.codes = append_keg(cst.codes, code)
-#define BACK_CODE (code_object*)back_keg(cst.codes)
+void emit_byte(compile_state* cst, uint8_t b) {
+  code_object* code = BACK_CODE;
+  if (code->len + 1 > code->cap) {
+    code->cap = code->cap == 0 ? 16 : code->cap * 2;
+    code->codes = realloc(code->codes, sizeof(uint8_t) * code->cap);
+  }
+  code->codes[code->len++] = b;
+}
 
-void replace_holder(int16_t place, int16_t off) {
+/* Sets the jump target at p of the code being compiled. */
+void replace_jump(compile_state* cst, int p, int off) {
   code_object* code = BACK_CODE;
-  if (code->offsets == NULL) {
-    return;
+  for (int i = 0; i < 4; i++) {
+    code->codes[p + i] = (uint32_t)off >> 8 * i & 0xff;
   }
-  for (int i = 0; i < code->offsets->item; i++) {
-    if (*(int16_t*)(code->offsets->data[i]) == place) {
-      int16_t* f = malloc(sizeof(int16_t));
-      *f = off;
-      replace_keg(code->offsets, i, f);
+}
+
+void replace_holder(compile_state* cst, int place, int off) {
+  code_object* code = BACK_CODE;
+  for (int i = 0; i < code->len; i += CODE_SIZE(code->codes[i])) {
+    uint8_t op = code->codes[i];
+    if ((op == JUMP_TO || op == T_JUMP_TO) &&
+        READ_JUMP(code->codes, i + 1) == place) {
+      replace_jump(cst, i + 1, off);
     }
   }
 }
 
-int16_t* get_offset_p() {
+/* Where the operand about to be emitted goes, kept to patch it later. */
+int* get_offset_p(compile_state* cst) {
   code_object* code = BACK_CODE;
-  int16_t* f = malloc(sizeof(int16_t));
-  *f = code->offsets->item;
+  int* f = malloc(sizeof(int));
+  *f = code->len;
   return f;
 }
 
-int get_code_len() {
+int get_code_len(compile_state* cst) {
   code_object* code = BACK_CODE;
-  if (code->codes == NULL) {
-    return 0;
+  return code->len;
+}
+
+/* Operands other than jump targets take 16 bits, a program needing more
+ * names, constants or values than that is not compiled. */
+void emit_offset(compile_state* cst, int off) {
+  if (off < INT16_MIN || off > INT16_MAX) {
+    TRACE("\033[1;31mcompiler %d:\033[0m too many names, constants or "
+          "values in one block.\n",
+          cst->pre.line)
   }
-  return code->codes->item;
+  emit_byte(cst, (uint16_t)off & 0xff);
+  emit_byte(cst, (uint16_t)off >> 8);
 }
 
-void insert_offset(int p, int16_t off) {
-  code_object* code = BACK_CODE;
-  int16_t* f = malloc(sizeof(int16_t));
-  *f = off;
-  if (p == -1) {
-    code->offsets = append_keg(code->offsets, f);
-  } else {
-    insert_keg(code->offsets, p, f);
+void emit_jump(compile_state* cst, int off) {
+  for (int i = 0; i < 4; i++) {
+    emit_byte(cst, (uint32_t)off >> 8 * i & 0xff);
   }
 }
 
-void emit_offset(int16_t off) {
+/* Tokens only refer to their literals in the source, so anything kept
+ * after compilation gets its own copy. Names are pooled. */
+char* name_of(compile_state* cst, token tok) {
+  return pool_slice(cst->tokens->src + tok.start, tok.len);
+}
+
+char* text_of(compile_state* cst, token tok) {
+  const char* s = cst->tokens->src + tok.start;
+  int len = tok.len;
+  if (tok.kind == EOH) {
+    s = token_string[EOH];
+    len = strlen(s);
+  }
+  char* str = malloc(len + 1);
+  memcpy(str, s, len);
+  str[len] = '\0';
+  return str;
+}
+
+bool literal_is(compile_state* cst, token tok, const char* s) {
+  return strncmp(cst->tokens->src + tok.start, s, tok.len) == 0 &&
+         s[tok.len] == '\0';
+}
+
+void emit_name(compile_state* cst, char* name) {
   code_object* code = BACK_CODE;
-  int16_t* f = malloc(sizeof(int16_t));
-  *f = off;
-  code->offsets = append_keg(code->offsets, f);
+  emit_offset(cst, pool_add_name(&code->names, name));
 }
 
-void emit_name(char* name) {
+/* Name spelled by a token. */
+void emit_ident(compile_state* cst, token tok) {
   code_object* code = BACK_CODE;
-  if (code->names != NULL) {
-    for (int i = 0; i < code->names->item; i++) {
-      if (strcmp((char*)code->names->data[i], name) == 0) {
-        emit_offset(i);
-        return;
-      }
-    }
-  }
-  code->names = append_keg(code->names, name);
-  emit_offset(cst.inf++);
+  const char* s = cst->tokens->src + tok.start;
+  emit_offset(cst, pool_add_slice(&code->names, s, tok.len));
 }
 
-void emit_type(type* t) {
+void emit_type(compile_state* cst, type* t) {
   code_object* code = BACK_CODE;
-  for (int i = 0; code->types != NULL && i < code->types->item; i++) {
-    type* x = code->types->data[i];
-    if (x->kind <= 4 && t->kind <= 4 && x->kind == t->kind) {
-      free(t);
-      emit_offset(i);
-      return;
-    }
-  }
-  code->types = append_keg(code->types, t);
-  emit_offset(cst.itf++);
+  emit_offset(cst, pool_add_type(&code->types, t));
 }
 
-void emit_obj(object* obj) {
+/* Numbers a member access for its inline cache. */
+void emit_site(compile_state* cst) {
   code_object* code = BACK_CODE;
-  code->objects = append_keg(code->objects, obj);
-  emit_offset(cst.iof++);
+  emit_offset(cst, code->sites++);
 }
 
-int l = 0;
-int t = -1;
+void emit_obj(compile_state* cst, object* obj) {
+  code_object* code = BACK_CODE;
+  emit_offset(cst, pool_add_obj(&code->objects, obj));
+}
 
-void emit_code(uint8_t op) {
-  op_code* c = malloc(sizeof(uint8_t));
-  *c = op;
-  int* n = malloc(sizeof(int));
-  if (t != -1) {
-    *n = t;
-    t = -1;
+void emit_code(compile_state* cst, uint8_t op) {
+  code_object* code = BACK_CODE;
+  if (cst->name_line != -1) {
+    add_line(&code->lines, code->len, cst->name_line);
+    cst->name_line = -1;
   } else {
-    *n = l;
+    add_line(&code->lines, code->len, cst->line);
   }
-  code_object* code = BACK_CODE;
-  code->codes = append_keg(code->codes, c);
-  code->lines = append_keg(code->lines, n);
+  code->count++;
+  cst->last = op;
+  emit_byte(cst, op);
 }
 
-int p = 0;
-
-void iter() {
-  cst.pre = cst.cur;
-  if (p == cst.tokens->item) {
+void iter(compile_state* cst) {
+  if (cst->tokens->done) {
+    cst->pre = cst->cur;
     return;
   }
-  cst.cur = *(token*)cst.tokens->data[p++];
-  cst.p = p - 2;
+  cst->back = cst->pre;
+  cst->pre = cst->cur;
+  cst->cur = next_token(cst->tokens);
 }
 
 typedef enum {
@@ -189,7 +218,7 @@ typedef enum {
   P_CALL,
 } precedence;
 
-typedef void (*function)();
+typedef void (*function)(compile_state*);
 
 typedef struct {
   token_kind kind;
@@ -199,336 +228,344 @@ typedef struct {
 } rule;
 
 rule get_rule(token_kind kind);
-void set_precedence(int prec);
+void set_precedence(compile_state* cst, int prec);
 
-static inline int get_pre_prec() {
-  return get_rule(cst.pre.kind).precedence;
+static inline int get_pre_prec(compile_state* cst) {
+  return get_rule(cst->pre.kind).precedence;
 }
 
-static inline int get_cur_prec() {
-  return get_rule(cst.cur.kind).precedence;
+static inline int get_cur_prec(compile_state* cst) {
+  return get_rule(cst->cur.kind).precedence;
 }
 
-static inline void both_iter() {
-  iter();
-  iter();
+static inline void both_iter(compile_state* cst) {
+  iter(cst);
+  iter(cst);
 }
 
 enum expect_kind { PRE, CUR };
 
-void expect_error(token_kind kind) {
+void expect_error(compile_state* cst, token_kind kind) {
   TRACE("\033[1;31mcompiler %d:\033[0m unexpected '%s' but it's '%s'.\n",
-        cst.pre.line, token_string[kind], cst.pre.literal)
+        cst->pre.line, token_string[kind], text_of(cst, cst->pre))
 }
 
-void expect(enum expect_kind exp, token_kind kind) {
-  if (exp == PRE && cst.pre.kind != kind) {
-    expect_error(kind);
+void expect(compile_state* cst, enum expect_kind exp, token_kind kind) {
+  if (exp == PRE && cst->pre.kind != kind) {
+    expect_error(cst, kind);
   }
-  if (exp == CUR && cst.cur.kind != kind) {
-    expect_error(kind);
+  if (exp == CUR && cst->cur.kind != kind) {
+    expect_error(cst, kind);
   }
-  iter();
+  iter(cst);
 }
 
-void debug() {
-  printf("%s %s\n", cst.pre.literal, cst.cur.literal);
+void debug(compile_state* cst) {
+  printf("%s %s\n", text_of(cst, cst->pre), text_of(cst, cst->cur));
 }
 
-void syntax_error() {
-  TRACE("\033[1;31mcompiler %d:\033[0m syntax error.\n", cst.pre.line)
+void syntax_error(compile_state* cst) {
+  TRACE("\033[1;31mcompiler %d:\033[0m syntax error.\n", cst->pre.line)
 }
 
-void no_block_error() {
-  TRACE("\033[1;31mcompiler %d:\033[0m no block statement.\n", cst.pre.line)
+void no_block_error(compile_state* cst) {
+  TRACE("\033[1;31mcompiler %d:\033[0m no block statement.\n", cst->pre.line)
 }
 
-void literal() {
-  token tok = cst.pre;
-  object* obj = malloc(sizeof(object));
+void literal(compile_state* cst) {
+  token tok = cst->pre;
+  object* obj = calloc(1, sizeof(object));
 
   switch (tok.kind) {
-    case NUMBER:
+    case NUMBER: {
+      char* s = text_of(cst, tok);
       obj->kind = OBJ_INT;
-      obj->value.num = atoi(tok.literal);
-      break;
-    case FLOAT:
+      obj->value.num = atoi(s);
+      free(s);
+    } break;
+    case FLOAT: {
+      char* s = text_of(cst, tok);
       obj->kind = OBJ_FLOAT;
-      obj->value.f = atof(tok.literal);
-      break;
+      obj->value.f = atof(s);
+      free(s);
+    } break;
     case CHAR:
       obj->kind = OBJ_CHAR;
-      obj->value.c = tok.literal[0];
+      obj->value.c = cst->tokens->src[tok.start];
       break;
     case STRING:
       obj->kind = OBJ_STRING;
-      obj->value.str = tok.literal;
+      obj->value.str = text_of(cst, tok);
       break;
     case NIL:
       obj->kind = OBJ_NIL;
       break;
   }
-  emit_obj(obj);
-  emit_code(CONST_OF);
+  emit_code(cst, CONST_OF);
+  emit_obj(cst, obj);
 }
 
-void name() {
-  token name = cst.pre;
-  token_kind kind = cst.cur.kind;
+void name(compile_state* cst) {
+  token name = cst->pre;
+  token_kind kind = cst->cur.kind;
 
   switch (kind) {
     case EQ:
-      both_iter();
-      set_precedence(P_LOWEST);
+      both_iter(cst);
+      set_precedence(cst, P_LOWEST);
 
-      emit_code(ASSIGN_TO);
-      emit_name(name.literal);
+      emit_code(cst, ASSIGN_TO);
+      emit_ident(cst, name);
       break;
     case R_ARROW:
-      both_iter();
+      both_iter(cst);
 
-      compile_state up_state = backup_state();
-      clear_state();
+      compile_state up_state = backup_state(cst);
 
-      code_object* code = new_code(name.literal);
+      code_object* code = new_code(name_of(cst, name));
       PUSH_CODE(code);
-      block();
+      block(cst);
 
-      reset_state(&cst, up_state);
+      reset_state(cst, up_state);
 
-      code_object* ptr = pop_back_keg(cst.codes);
-      object* obj = malloc(sizeof(object));
+      code_object* ptr = pop_back_keg(cst->codes);
+      object* obj = calloc(1, sizeof(object));
       obj->kind = OBJ_EBLOCK;
-      obj->value.eb.name = name.literal;
+      obj->value.eb.name = name_of(cst, name);
       obj->value.eb.code = ptr;
 
-      emit_code(SET_EB);
-      emit_obj(obj);
+      emit_code(cst, SET_EB);
+      emit_obj(cst, obj);
       break;
     default:
-      emit_code(LOAD_OF);
-      emit_name(name.literal);
+      emit_code(cst, LOAD_OF);
+      emit_ident(cst, name);
   }
 }
 
-void recv_eb() {
-  iter();
-  set_precedence(P_LOWEST);
-  emit_code(RECV_EB);
+void recv_eb(compile_state* cst) {
+  iter(cst);
+  set_precedence(cst, P_LOWEST);
+  emit_code(cst, RECV_EB);
 }
 
-void unary() {
-  token_kind op = cst.pre.kind;
-  iter();
-  set_precedence(P_UNARY);
+void unary(compile_state* cst) {
+  token_kind op = cst->pre.kind;
+  iter(cst);
+  set_precedence(cst, P_UNARY);
 
   if (op == SUB) {
-    emit_code(TO_NOT);
+    emit_code(cst, TO_NOT);
   }
   if (op == BANG) {
-    emit_code(TO_BANG);
+    emit_code(cst, TO_BANG);
   }
 }
 
-void binary() {
-  token_kind op = cst.pre.kind;
+void binary(compile_state* cst) {
+  token_kind op = cst->pre.kind;
 
-  int prec = get_pre_prec();
-  iter();
-  set_precedence(prec);
+  int prec = get_pre_prec(cst);
+  iter(cst);
+  set_precedence(cst, prec);
 
   switch (op) {
     case ADD:
-      emit_code(TO_ADD);
+      emit_code(cst, TO_ADD);
       break;
     case SUB:
-      emit_code(TO_SUB);
+      emit_code(cst, TO_SUB);
       break;
     case MUL:
-      emit_code(TO_MUL);
+      emit_code(cst, TO_MUL);
       break;
     case DIV:
-      emit_code(TO_DIV);
+      emit_code(cst, TO_DIV);
       break;
     case SUR:
-      emit_code(TO_SUR);
+      emit_code(cst, TO_SUR);
       break;
     case OR:
-      emit_code(TO_OR);
+      emit_code(cst, TO_OR);
       break;
     case ADDR:
-      emit_code(TO_AND);
+      emit_code(cst, TO_AND);
       break;
     case EQ_EQ:
-      emit_code(TO_EQ_EQ);
+      emit_code(cst, TO_EQ_EQ);
       break;
     case BANG_EQ:
-      emit_code(TO_NOT_EQ);
+      emit_code(cst, TO_NOT_EQ);
       break;
     case GREATER:
-      emit_code(TO_GR);
+      emit_code(cst, TO_GR);
       break;
     case GR_EQ:
-      emit_code(TO_GR_EQ);
+      emit_code(cst, TO_GR_EQ);
       break;
     case LESS:
-      emit_code(TO_LE);
+      emit_code(cst, TO_LE);
       break;
     case LE_EQ:
-      emit_code(TO_LE_EQ);
+      emit_code(cst, TO_LE_EQ);
       break;
   }
 }
 
-void group() {
-  iter();
-  if (cst.cur.kind == R_PAREN || cst.cur.kind == COMMA) {
+void group(compile_state* cst) {
+  iter(cst);
+  if (cst->cur.kind == R_PAREN || cst->cur.kind == COMMA) {
     int item = 0;
-    while (cst.pre.kind != R_PAREN) {
-      set_precedence(P_LOWEST);
+    while (cst->pre.kind != R_PAREN) {
+      set_precedence(cst, P_LOWEST);
       item++;
-      iter();
-      if (cst.pre.kind == R_PAREN) {
+      iter(cst);
+      if (cst->pre.kind == R_PAREN) {
         break;
       }
-      expect(PRE, COMMA);
+      expect(cst, PRE, COMMA);
     }
-    emit_code(BUILD_TUP);
-    emit_offset(item);
+    emit_code(cst, BUILD_TUP);
+    emit_offset(cst, item);
     return;
   }
-  if (cst.pre.kind == R_PAREN) {
-    emit_code(BUILD_TUP);
-    emit_offset(0);
+  if (cst->pre.kind == R_PAREN) {
+    emit_code(cst, BUILD_TUP);
+    emit_offset(cst, 0);
     return;
   }
-  set_precedence(P_LOWEST);
-  expect(CUR, R_PAREN);
+  set_precedence(cst, P_LOWEST);
+  expect(cst, CUR, R_PAREN);
 }
 
-void get() {
-  iter();
-  token name = cst.pre;
-  if (cst.cur.kind == EQ) {
-    both_iter();
-    set_precedence(P_LOWEST);
-    emit_code(SET_OF);
+void get(compile_state* cst) {
+  iter(cst);
+  token name = cst->pre;
+  if (cst->cur.kind == EQ) {
+    both_iter(cst);
+    set_precedence(cst, P_LOWEST);
+    emit_code(cst, SET_OF);
+    emit_ident(cst, name);
   } else {
-    emit_code(GET_OF);
+    emit_code(cst, GET_OF);
+    emit_ident(cst, name);
+    emit_site(cst);
   }
-  emit_name(name.literal);
 }
 
-void call() {
-  iter();
+void call(compile_state* cst) {
+  iter(cst);
   int item = 0;
-  while (cst.pre.kind != R_PAREN) {
-    set_precedence(P_LOWEST);
+  while (cst->pre.kind != R_PAREN) {
+    set_precedence(cst, P_LOWEST);
     item++;
-    iter();
-    if (cst.pre.kind == R_PAREN) {
+    iter(cst);
+    if (cst->pre.kind == R_PAREN) {
       break;
     }
-    expect(PRE, COMMA);
+    expect(cst, PRE, COMMA);
   }
-  emit_code(CALL_FUNC);
-  emit_offset(item);
+  emit_code(cst, CALL_FUNC);
+  emit_offset(cst, item);
 }
 
-void indexes() {
-  iter();
-  set_precedence(P_LOWEST);
-  expect(CUR, R_BRACKET);
-  if (cst.cur.kind == EQ) {
-    both_iter();
-    set_precedence(P_LOWEST);
-    emit_code(TO_REPLACE);
+void indexes(compile_state* cst) {
+  iter(cst);
+  set_precedence(cst, P_LOWEST);
+  expect(cst, CUR, R_BRACKET);
+  if (cst->cur.kind == EQ) {
+    both_iter(cst);
+    set_precedence(cst, P_LOWEST);
+    emit_code(cst, TO_REPLACE);
   } else {
-    emit_code(TO_INDEX);
+    emit_code(cst, TO_INDEX);
   }
 }
 
-void array() {
-  iter();
+void array(compile_state* cst) {
+  iter(cst);
   int item = 0;
-  while (cst.pre.kind != R_BRACKET) {
-    set_precedence(P_LOWEST);
+  while (cst->pre.kind != R_BRACKET) {
+    set_precedence(cst, P_LOWEST);
     item++;
-    iter();
-    if (cst.pre.kind == R_BRACKET) {
+    iter(cst);
+    if (cst->pre.kind == R_BRACKET) {
       break;
     }
-    expect(PRE, COMMA);
+    expect(cst, PRE, COMMA);
   }
-  emit_code(BUILD_ARR);
-  emit_offset(item);
+  emit_code(cst, BUILD_ARR);
+  emit_offset(cst, item);
 }
 
-void map() {
-  iter();
+void map(compile_state* cst) {
+  iter(cst);
   int item = 0;
-  while (cst.pre.kind != R_BRACE) {
-    set_precedence(P_LOWEST);
-    iter();
-    expect(PRE, COLON);
-    set_precedence(P_LOWEST);
-    iter();
+  while (cst->pre.kind != R_BRACE) {
+    set_precedence(cst, P_LOWEST);
+    iter(cst);
+    expect(cst, PRE, COLON);
+    set_precedence(cst, P_LOWEST);
+    iter(cst);
     item += 2;
-    if (cst.pre.kind == R_BRACE) {
+    if (cst->pre.kind == R_BRACE) {
       break;
     }
-    expect(PRE, COMMA);
+    expect(cst, PRE, COMMA);
   }
-  emit_code(BUILD_MAP);
-  emit_offset(item);
+  emit_code(cst, BUILD_MAP);
+  emit_offset(cst, item);
 }
 
-void tnew() {
-  iter();
-  set_precedence(P_LOWEST);
-  iter();
-  expect(PRE, L_BRACE);
+void tnew(compile_state* cst) {
+  iter(cst);
+  set_precedence(cst, P_LOWEST);
+  iter(cst);
+  expect(cst, PRE, L_BRACE);
   int item = 0;
-  while (cst.pre.kind != R_BRACE) {
-    if (cst.pre.kind != LITERAL) {
-      syntax_error();
+  while (cst->pre.kind != R_BRACE) {
+    if (cst->pre.kind != LITERAL) {
+      syntax_error(cst);
     }
-    emit_code(SET_NAME);
-    emit_name(cst.pre.literal);
-    iter();
-    expect(PRE, COLON);
-    set_precedence(P_LOWEST);
-    iter();
+    emit_code(cst, SET_NAME);
+    emit_ident(cst, cst->pre);
+    iter(cst);
+    expect(cst, PRE, COLON);
+    set_precedence(cst, P_LOWEST);
+    iter(cst);
     item += 2;
-    if (cst.pre.kind == R_BRACE) {
+    if (cst->pre.kind == R_BRACE) {
       break;
     }
-    expect(PRE, COMMA);
+    expect(cst, PRE, COMMA);
   }
-  emit_code(NEW_OBJ);
-  emit_offset(item);
+  emit_code(cst, NEW_OBJ);
+  emit_offset(cst, item);
 }
 
-void gcin() {
-  iter();
-  if (cst.pre.kind != LITERAL) {
-    syntax_error();
+void gcin(compile_state* cst) {
+  iter(cst);
+  if (cst->pre.kind != LITERAL) {
+    syntax_error(cst);
   }
-  emit_name(cst.pre.literal);
-  emit_code(GET_IN_OF);
+  emit_code(cst, GET_IN_OF);
+  emit_ident(cst, cst->pre);
+  emit_site(cst);
 }
 
-void gmod() {
-  iter();
-  token name = cst.pre;
-  if (cst.cur.kind == EQ) {
-    both_iter();
-    set_precedence(P_LOWEST);
-    emit_code(REF_SET);
+void gmod(compile_state* cst) {
+  iter(cst);
+  token name = cst->pre;
+  if (cst->cur.kind == EQ) {
+    both_iter(cst);
+    set_precedence(cst, P_LOWEST);
+    emit_code(cst, REF_SET);
+    emit_ident(cst, name);
   } else {
-    emit_code(REF_MODULE);
+    emit_code(cst, REF_MODULE);
+    emit_ident(cst, name);
+    emit_site(cst);
   }
-  emit_name(name.literal);
 }
 
 #define RULE_COUNT 28
@@ -559,131 +596,131 @@ rule get_rule(token_kind kind) {
   return rules[0];
 }
 
-void set_precedence(int precedence) {
-  rule prefix = get_rule(cst.pre.kind);
+void set_precedence(compile_state* cst, int precedence) {
+  rule prefix = get_rule(cst->pre.kind);
   if (prefix.prefix == NULL) {
     TRACE(
         "\033[1;31mcompiler %d:\033[0m not found prefix function of token "
         "'%s'.\n",
-        cst.pre.line, cst.pre.literal)
+        cst->pre.line, text_of(cst, cst->pre))
     return;
   }
-  prefix.prefix();
-  while (precedence <= get_cur_prec()) {
-    rule infix = get_rule(cst.cur.kind);
+  prefix.prefix(cst);
+  while (precedence <= get_cur_prec(cst)) {
+    rule infix = get_rule(cst->cur.kind);
     if (infix.infix != NULL) {
-      iter();
-      infix.infix();
+      iter(cst);
+      infix.infix(cst);
     } else {
       break;
     }
   }
 }
 
-type* set_type() {
-  token now = cst.pre;
+type* set_type(compile_state* cst) {
+  token now = cst->pre;
   type* T = malloc(sizeof(type));
   switch (now.kind) {
     case LITERAL:
-      if (strcmp(now.literal, "int") == 0)
+      if (literal_is(cst, now, "int"))
         T->kind = T_INT;
-      else if (strcmp(now.literal, "float") == 0)
+      else if (literal_is(cst, now, "float"))
         T->kind = T_FLOAT;
-      else if (strcmp(now.literal, "bool") == 0)
+      else if (literal_is(cst, now, "bool"))
         T->kind = T_BOOL;
-      else if (strcmp(now.literal, "char") == 0)
+      else if (literal_is(cst, now, "char"))
         T->kind = T_CHAR;
-      else if (strcmp(now.literal, "string") == 0)
+      else if (literal_is(cst, now, "string"))
         T->kind = T_STRING;
-      else if (strcmp(now.literal, "any") == 0)
+      else if (literal_is(cst, now, "any"))
         T->kind = T_ANY;
       else {
         T->kind = T_USER;
-        T->inner.name = now.literal;
+        T->inner.name = name_of(cst, now);
       }
       break;
     case L_BRACKET: {
-      both_iter();
+      both_iter(cst);
       T->kind = T_ARRAY;
-      T->inner.single = (struct type*)set_type();
+      T->inner.single = (struct type*)set_type(cst);
       break;
     }
     case L_PAREN: {
-      both_iter();
+      both_iter(cst);
       T->kind = T_TUPLE;
-      T->inner.single = (struct type*)set_type();
+      T->inner.single = (struct type*)set_type(cst);
       break;
     }
     case L_BRACE: {
-      both_iter();
+      both_iter(cst);
       T->kind = T_MAP;
-      expect(PRE, LESS);
-      T->inner.both.T1 = (struct type*)set_type();
-      iter();
-      expect(PRE, COMMA);
-      T->inner.both.T2 = (struct type*)set_type();
-      expect(CUR, GREATER);
+      expect(cst, PRE, LESS);
+      T->inner.both.T1 = (struct type*)set_type(cst);
+      iter(cst);
+      expect(cst, PRE, COMMA);
+      T->inner.both.T2 = (struct type*)set_type(cst);
+      expect(cst, CUR, GREATER);
       break;
     }
     case OR:
-      iter();
+      iter(cst);
       keg* arg = new_keg();
       type* ret = NULL;
-      while (cst.pre.kind != OR) {
-        arg = append_keg(arg, set_type());
-        iter();
-        if (cst.pre.kind == OR) {
+      while (cst->pre.kind != OR) {
+        arg = append_keg(arg, set_type(cst));
+        iter(cst);
+        if (cst->pre.kind == OR) {
           break;
         }
-        expect(PRE, COMMA);
+        expect(cst, PRE, COMMA);
       }
-      if (cst.cur.kind == R_ARROW) {
-        both_iter();
-        ret = set_type();
+      if (cst->cur.kind == R_ARROW) {
+        both_iter(cst);
+        ret = set_type(cst);
       }
       T->kind = T_FUNCTION;
       T->inner.fn.arg = arg;
       T->inner.fn.ret = (struct type*)ret;
       break;
     default:
-      TRACE("\033[1;31mcompiler %d:\033[0m unknown '%s' type.\n", cst.pre.line,
-            cst.pre.literal);
+      TRACE("\033[1;31mcompiler %d:\033[0m unknown '%s' type.\n", cst->pre.line,
+            text_of(cst, cst->pre));
   }
   return T;
 }
 
-keg* parse_generic() {
+keg* parse_generic(compile_state* cst) {
   keg* gt = new_keg();
-  iter();
-  if (cst.pre.kind == GREATER) {
-    syntax_error();
+  iter(cst);
+  if (cst->pre.kind == GREATER) {
+    syntax_error(cst);
   }
   while (true) {
-    token name = cst.pre;
+    token name = cst->pre;
     if (name.kind != LITERAL) {
-      syntax_error();
+      syntax_error(cst);
     }
-    iter();
+    iter(cst);
 
     type* t = malloc(sizeof(type));
     t->kind = T_GENERIC;
 
     generic* ge = malloc(sizeof(generic));
-    ge->name = name.literal;
+    ge->name = name_of(cst, name);
 
-    if (cst.pre.kind == GREATER || cst.pre.kind == COMMA) {
+    if (cst->pre.kind == GREATER || cst->pre.kind == COMMA) {
       ge->count = 0;
     } else {
-      type* T = set_type();
-      iter();
-      if (cst.pre.kind == OR) {
+      type* T = set_type(cst);
+      iter(cst);
+      if (cst->pre.kind == OR) {
         ge->mtype.multiple = new_keg();
         ge->mtype.multiple = append_keg(ge->mtype.multiple, T);
-        iter();
+        iter(cst);
 
-        while (cst.pre.kind != COMMA && cst.pre.kind != GREATER) {
-          ge->mtype.multiple = append_keg(ge->mtype.multiple, set_type());
-          iter();
+        while (cst->pre.kind != COMMA && cst->pre.kind != GREATER) {
+          ge->mtype.multiple = append_keg(ge->mtype.multiple, set_type(cst));
+          iter(cst);
         }
         ge->count = ge->mtype.multiple->item;
       } else {
@@ -694,12 +731,12 @@ keg* parse_generic() {
     t->inner.ge = (struct generic*)ge;
     gt = append_keg(gt, t);
 
-    if (cst.pre.kind == COMMA) {
-      iter();
+    if (cst->pre.kind == COMMA) {
+      iter(cst);
       continue;
     }
-    if (cst.pre.kind == GREATER) {
-      iter();
+    if (cst->pre.kind == GREATER) {
+      iter(cst);
       break;
     }
   }
@@ -708,80 +745,80 @@ keg* parse_generic() {
 
 enum generic_type { NONE_TYPE, OTHER };
 
-void check_generic_type(keg* gt, enum generic_type t) {
+void check_generic_type(compile_state* cst, keg* gt, enum generic_type t) {
   for (int i = 0; i < gt->item; i++) {
     generic* g = (generic*)((type*)gt->data[i])->inner.ge;
     if (t == NONE_TYPE && g->count != 0) {
-      syntax_error();
+      syntax_error(cst);
     }
     if (t == OTHER && g->count < 1) {
-      syntax_error();
+      syntax_error(cst);
     }
   }
 }
 
-void def_interface(token name, keg* gt, int off, int poff) {
+void def_interface(compile_state* cst, token name, keg* gt, int off, int poff) {
   if (off <= poff) {
-    no_block_error();
+    no_block_error(cst);
   }
-  check_generic_type(gt, NONE_TYPE);
+  check_generic_type(cst, gt, NONE_TYPE);
 
-  object* obj = malloc(sizeof(object));
+  object* obj = calloc(1, sizeof(object));
   obj->kind = OBJ_INTERFACE;
-  obj->value.in.name = name.literal;
+  obj->value.in.name = name_of(cst, name);
   obj->value.in.element = NULL;
   obj->value.in.gt = gt;
 
   while (true) {
     method* m = malloc(sizeof(method));
     m->ret = NULL;
-    iter();
+    iter(cst);
 
-    if (cst.pre.kind != SLASH) {
+    if (cst->pre.kind != SLASH) {
       keg* arg = new_keg();
 
       while (true) {
-        arg = append_keg(arg, set_type());
-        iter();
-        if (cst.pre.kind == SLASH) {
+        arg = append_keg(arg, set_type(cst));
+        iter(cst);
+        if (cst->pre.kind == SLASH) {
           break;
         }
-        expect(PRE, COMMA);
+        expect(cst, PRE, COMMA);
       }
-      iter();
+      iter(cst);
 
-      m->name = cst.pre.literal;
+      m->name = name_of(cst, cst->pre);
       m->arg = arg;
     } else {
-      iter();
-      m->name = cst.pre.literal;
+      iter(cst);
+      m->name = name_of(cst, cst->pre);
       m->arg = new_keg();
     }
-    if (cst.cur.kind == R_ARROW) {
-      both_iter();
-      m->ret = set_type();
+    if (cst->cur.kind == R_ARROW) {
+      both_iter(cst);
+      m->ret = set_type(cst);
     }
 
     obj->value.in.element = append_keg(obj->value.in.element, m);
 
-    if (cst.cur.off == off) {
-      iter();
+    if (cst->cur.off == off) {
+      iter(cst);
     } else {
       break;
     }
   }
-  t = name.line;
-  emit_code(INTERFACE);
-  emit_obj(obj);
+  cst->name_line = name.line;
+  emit_code(cst, INTERFACE);
+  emit_obj(cst, obj);
 }
 
-void def_function(keg* gt) {
-  check_generic_type(gt, OTHER);
+void def_function(compile_state* cst, keg* gt) {
+  check_generic_type(cst, gt, OTHER);
 
   keg* K = new_keg();
   keg* V = new_keg();
 
-  object* obj = malloc(sizeof(object));
+  object* obj = calloc(1, sizeof(object));
   obj->kind = OBJ_FUNCTION;
   obj->value.fn.k = K;
   obj->value.fn.v = V;
@@ -789,89 +826,88 @@ void def_function(keg* gt) {
   obj->value.fn.self = NULL;
   obj->value.fn.gt = gt;
 
-  if (cst.pre.kind != R_PAREN) {
+  if (cst->pre.kind != R_PAREN) {
     while (true) {
-      if (cst.cur.kind == R_PAREN) {
+      if (cst->cur.kind == R_PAREN) {
         break;
       }
 
-      K = append_keg(K, cst.pre.literal);
-      if (cst.cur.kind != COMMA) {
-        iter();
+      K = append_keg(K, name_of(cst, cst->pre));
+      if (cst->cur.kind != COMMA) {
+        iter(cst);
 
-        if (cst.pre.kind == L_ARROW) {
-          iter();
-          obj->value.fn.mutiple = set_type();
+        if (cst->pre.kind == L_ARROW) {
+          iter(cst);
+          obj->value.fn.mutiple = set_type(cst);
 
-          iter();
-          if (cst.pre.kind != R_PAREN) {
+          iter(cst);
+          if (cst->pre.kind != R_PAREN) {
+            TRACE_JUMP()
             fprintf(stderr,
                     "\033[1;31mcompiler %d:\033[0m multiple "
                     "parameters can only be at the end.\n",
-                    cst.pre.line);
+                    cst->pre.line);
             exit(EXIT_SUCCESS);
           }
           break;
         }
-        type* T = set_type();
-        iter();
+        type* T = set_type(cst);
+        iter(cst);
 
         while (K->item != V->item) {
           V = append_keg(V, T);
         }
-        if (cst.pre.kind == R_PAREN) {
+        if (cst->pre.kind == R_PAREN) {
           break;
         }
-        expect(PRE, COMMA);
+        expect(cst, PRE, COMMA);
       } else {
-        both_iter();
+        both_iter(cst);
       }
     }
   }
-  iter();
-  token name = cst.pre;
-  iter();
-
-  if (cst.pre.kind == R_ARROW) {
-    iter();
-    obj->value.fn.ret = set_type();
-    iter();
+  iter(cst);
+  token name = cst->pre;
+  iter(cst);
+
+  if (cst->pre.kind == R_ARROW) {
+    iter(cst);
+    obj->value.fn.ret = set_type(cst);
+    iter(cst);
   } else {
     obj->value.fn.ret = NULL;
   }
-  compile_state up_state = backup_state();
-  clear_state();
+  compile_state up_state = backup_state(cst);
 
-  code_object* code = new_code(name.literal);
+  code_object* code = new_code(name_of(cst, name));
   PUSH_CODE(code);
-  block();
+  block(cst);
 
-  reset_state(&cst, up_state);
+  reset_state(cst, up_state);
 
-  code_object* ptr = pop_back_keg(cst.codes);
+  code_object* ptr = pop_back_keg(cst->codes);
   obj->value.fn.name = ptr->description;
   obj->value.fn.code = ptr;
 
-  t = name.line;
-  emit_code(FUNCTION);
-  emit_obj(obj);
+  cst->name_line = name.line;
+  emit_code(cst, FUNCTION);
+  emit_obj(cst, obj);
 }
 
-void def_class(token name, keg* gt) {
-  check_generic_type(gt, OTHER);
+void def_class(compile_state* cst, token name, keg* gt) {
+  check_generic_type(cst, gt, OTHER);
 
-  compile_state up_state = backup_state();
-  clear_state();
+  compile_state up_state = backup_state(cst);
 
-  code_object* code = new_code(name.literal);
+  code_object* code = new_code(name_of(cst, name));
   PUSH_CODE(code);
-  block();
+  block(cst);
 
-  reset_state(&cst, up_state);
+  reset_state(cst, up_state);
 
-  code_object* ptr = pop_back_keg(cst.codes);
+  code_object* ptr = pop_back_keg(cst->codes);
 
-  object* obj = malloc(sizeof(object));
+  object* obj = calloc(1, sizeof(object));
   obj->kind = OBJ_CLASS;
   obj->value.cl.name = ptr->description;
   obj->value.cl.code = ptr;
@@ -879,408 +915,557 @@ void def_class(token name, keg* gt) {
   obj->value.cl.init = false;
   obj->value.cl.gt = gt;
 
-  t = name.line;
-  emit_code(CLASS);
-  emit_obj(obj);
+  cst->name_line = name.line;
+  emit_code(cst, CLASS);
+  emit_obj(cst, obj);
 }
 
-void stmt() {
-  l = cst.pre.line;
-  switch (cst.pre.kind) {
+/* Discards the value an expression statement leaves on the stack. At the
+ * top of the REPL it is kept instead, the last one is printed. */
+void drop_value(compile_state* cst) {
+  uint8_t op = cst->last;
+  if (op == ASSIGN_TO || op == TO_REPLACE || op == SET_OF || op == REF_SET ||
+      op == SET_EB || op == RECV_EB) {
+    return;
+  }
+  bool top = repl_mode && cst->codes->item == 1;
+  if (top && cst->nest == 0) {
+    cst->kept++;
+    return;
+  }
+  emit_code(cst, DROP_TO);
+  emit_offset(cst, top ? cst->kept : 0);
+}
+
+void stmt(compile_state* cst) {
+  bool ret = cst->ret;
+  cst->ret = false;
+  cst->line = cst->pre.line;
+  switch (cst->pre.kind) {
     case DEF: {
-      iter();
-      if (cst.pre.kind == EOH) {
+      iter(cst);
+      if (cst->pre.kind == EOH) {
         return;
       }
 
       keg* gt = new_keg();
-      if (cst.pre.kind == LESS) {
-        gt = parse_generic();
+      if (cst->pre.kind == LESS) {
+        gt = parse_generic(cst);
       }
-      token name = cst.pre;
-      iter();
+      token name = cst->pre;
+      iter(cst);
 
-      int poff = (*(token*)(cst.tokens->data)[cst.p - 1]).off;
+      int poff = cst->back.off;
 
-      if (cst.pre.kind == LESS) {
+      if (cst->pre.kind == LESS) {
         if (gt->data != NULL) {
-          syntax_error();
+          syntax_error(cst);
         }
-        gt = parse_generic();
+        gt = parse_generic(cst);
       }
-      int off = cst.pre.off;
+      int off = cst->pre.off;
 
-      if (cst.pre.kind == SLASH) {
-        def_interface(name, gt, off, poff);
+      if (cst->pre.kind == SLASH) {
+        def_interface(cst, name, gt, off, poff);
       } else if (name.kind == L_PAREN) {
-        def_function(gt);
-      } else if (cst.pre.kind == DEF) {
-        def_class(name, gt);
+        def_function(cst, gt);
+      } else if (cst->pre.kind == DEF) {
+        def_class(cst, name, gt);
       } else {
-        type* T = set_type();
-        iter();
+        type* T = set_type(cst);
+        iter(cst);
 
-        if (cst.pre.kind == EQ) {
-          iter();
-          set_precedence(P_LOWEST);
+        if (cst->pre.kind == EQ) {
+          iter(cst);
+          set_precedence(cst, P_LOWEST);
 
-          emit_type(T);
-          emit_code(STORE_NAME);
-          emit_name(name.literal);
+          emit_code(cst, STORE_NAME);
+          emit_type(cst, T);
+          emit_ident(cst, name);
         } else {
           if (T->kind != T_USER) {
-            syntax_error();
+            syntax_error(cst);
           }
           if (off <= poff) {
-            no_block_error();
+            no_block_error(cst);
           }
           keg* elem = new_keg();
           elem = append_keg(elem, T->inner.name);
           free(T);
 
           while (true) {
-            elem = append_keg(elem, cst.pre.literal);
-            if (cst.cur.off == off) {
-              iter();
+            elem = append_keg(elem, name_of(cst, cst->pre));
+            if (cst->cur.off == off) {
+              iter(cst);
             } else {
               break;
             }
           }
-          object* obj = malloc(sizeof(object));
+          object* obj = calloc(1, sizeof(object));
           obj->kind = OBJ_ENUMERATE;
-          obj->value.en.name = name.literal;
+          obj->value.en.name = name_of(cst, name);
           obj->value.en.element = elem;
 
-          emit_code(ENUMERATE);
-          emit_obj(obj);
+          emit_code(cst, ENUMERATE);
+          emit_obj(cst, obj);
         }
       }
       break;
     }
     case IF: {
-      iter();
-      set_precedence(P_LOWEST);
-      iter();
+      iter(cst);
+      set_precedence(cst, P_LOWEST);
+      iter(cst);
 
-      emit_code(F_JUMP_TO);
-      int16_t if_p = *get_offset_p();
-      block();
+      emit_code(cst, F_JUMP_TO);
+      int if_p = get_code_len(cst);
+      emit_jump(cst, 0);
+      block(cst);
 
       keg* p = new_keg();
 
-      if (cst.cur.kind == EF || cst.cur.kind == NF) {
-        p = append_keg(p, get_offset_p());
-        emit_code(JUMP_TO);
+      if (cst->cur.kind == EF || cst->cur.kind == NF) {
+        emit_code(cst, JUMP_TO);
+        p = append_keg(p, get_offset_p(cst));
+        emit_jump(cst, 0);
       }
 
-      insert_offset(if_p, get_code_len());
+      replace_jump(cst, if_p, get_code_len(cst));
 
-      while (cst.cur.kind == EF) {
-        both_iter();
-        set_precedence(P_LOWEST);
-        iter();
+      while (cst->cur.kind == EF) {
+        both_iter(cst);
+        set_precedence(cst, P_LOWEST);
+        iter(cst);
 
-        emit_code(F_JUMP_TO);
-        int16_t ef_p = *get_offset_p();
-        block();
+        emit_code(cst, F_JUMP_TO);
+        int ef_p = get_code_len(cst);
+        emit_jump(cst, 0);
+        block(cst);
 
-        if (cst.cur.kind == EF || cst.cur.kind == NF) {
-          int16_t* f = get_offset_p();
-          *f += 1;
-          p = append_keg(p, f);
-          emit_code(JUMP_TO);
+        if (cst->cur.kind == EF || cst->cur.kind == NF) {
+          emit_code(cst, JUMP_TO);
+          p = append_keg(p, get_offset_p(cst));
+          emit_jump(cst, 0);
         }
 
-        insert_offset(ef_p, get_code_len());
+        replace_jump(cst, ef_p, get_code_len(cst));
       }
-      if (cst.cur.kind == NF) {
-        both_iter();
-        block();
+      if (cst->cur.kind == NF) {
+        both_iter(cst);
+        block(cst);
       }
       for (int i = 0; i < p->item; i++) {
-        int f = *(int*)p->data[i];
-        insert_offset(f + 1, get_code_len());
+        replace_jump(cst, *(int*)p->data[i], get_code_len(cst));
+        free(p->data[i]);
       }
       free_keg(p);
       break;
     }
     case AOP: {
-      cst.loop = true;
-      iter();
+      cst->loop = true;
+      iter(cst);
 
-      int begin_p = get_code_len();
-      if (cst.pre.kind != R_ARROW) {
-        set_precedence(P_LOWEST);
-        iter();
+      int begin_p = get_code_len(cst);
+      if (cst->pre.kind != R_ARROW) {
+        set_precedence(cst, P_LOWEST);
+        iter(cst);
 
-        emit_code(F_JUMP_TO);
-        int16_t expr_p = *get_offset_p();
+        emit_code(cst, F_JUMP_TO);
+        int expr_p = get_code_len(cst);
+        emit_jump(cst, 0);
 
-        block();
+        block(cst);
 
-        emit_code(JUMP_TO);
-        insert_offset(-1, begin_p);
+        emit_code(cst, JUMP_TO);
+        emit_jump(cst, begin_p);
 
-        insert_offset(expr_p, get_code_len());
+        replace_jump(cst, expr_p, get_code_len(cst));
       } else {
-        iter();
-        block();
+        iter(cst);
+        block(cst);
 
-        emit_code(JUMP_TO);
-        insert_offset(-1, begin_p);
+        emit_code(cst, JUMP_TO);
+        emit_jump(cst, begin_p);
       }
 
-      replace_holder(-1, get_code_len());
-      replace_holder(-2, begin_p);
+      replace_holder(cst, -1, get_code_len(cst));
+      replace_holder(cst, -2, begin_p);
       break;
     }
     case FOR: {
-      cst.loop = true;
-      iter();
+      cst->loop = true;
+      iter(cst);
 
-      if (cst.pre.kind == LITERAL && cst.cur.kind == L_ARROW) {
-        token name = cst.pre;
+      if (cst->pre.kind == LITERAL && cst->cur.kind == L_ARROW) {
+        token name = cst->pre;
 
-        both_iter();
-        stmt();
+        both_iter(cst);
+        if (cst->pre.kind != LITERAL) {
+          syntax_error(cst);
+        }
+        token list = cst->pre;
 
-        int begin_p = get_code_len() + 1;
+        int begin = get_code_len(cst);
 
-        emit_code(RANGE_OF);
-        emit_name(name.literal);
-        int16_t begin_of = *get_offset_p();
-        int begin = get_code_len();
+        emit_code(cst, RANGE_OF);
+        emit_ident(cst, name);
+        emit_ident(cst, list);
+        int begin_of = get_code_len(cst);
+        emit_jump(cst, 0);
+        int begin_p = get_code_len(cst);
 
-        iter();
-        block();
+        iter(cst);
+        block(cst);
 
-        emit_code(RANGE_GO);
-        emit_name(name.literal);
-        emit_offset(begin_p);
+        emit_code(cst, RANGE_GO);
+        emit_ident(cst, name);
+        emit_jump(cst, begin_p);
 
-        insert_offset(begin_of, get_code_len());
+        replace_jump(cst, begin_of, get_code_len(cst));
 
-        replace_holder(-1, get_code_len());
-        replace_holder(-2, begin - 1);
+        replace_holder(cst, -1, get_code_len(cst));
+        replace_holder(cst, -2, begin);
         break;
       }
 
-      stmt();
-      iter();
-      expect(PRE, SEMICOLON);
+      stmt(cst);
+      iter(cst);
+      expect(cst, PRE, SEMICOLON);
 
-      int begin_p = get_code_len();
+      int begin_p = get_code_len(cst);
 
-      set_precedence(P_LOWEST);
-      iter();
-      expect(PRE, SEMICOLON);
-      emit_code(F_JUMP_TO);
-      int16_t expr_p = *get_offset_p();
+      set_precedence(cst, P_LOWEST);
+      iter(cst);
+      expect(cst, PRE, SEMICOLON);
+      emit_code(cst, F_JUMP_TO);
+      int expr_p = get_code_len(cst);
+      emit_jump(cst, 0);
 
-      emit_code(JUMP_TO);
-      int16_t body_p = *get_offset_p();
+      emit_code(cst, JUMP_TO);
+      int body_p = get_code_len(cst);
+      emit_jump(cst, 0);
 
-      int update_p = get_code_len();
+      int update_p = get_code_len(cst);
 
-      set_precedence(P_LOWEST);
-      iter();
-      emit_code(JUMP_TO);
-      insert_offset(-1, begin_p);
+      set_precedence(cst, P_LOWEST);
+      drop_value(cst);
+      iter(cst);
+      emit_code(cst, JUMP_TO);
+      emit_jump(cst, begin_p);
 
-      insert_offset(body_p, get_code_len());
-      block();
-      emit_code(JUMP_TO);
-      insert_offset(-1, update_p);
+      replace_jump(cst, body_p, get_code_len(cst));
+      block(cst);
+      emit_code(cst, JUMP_TO);
+      emit_jump(cst, update_p);
 
-      insert_offset(expr_p, get_code_len());
+      replace_jump(cst, expr_p, get_code_len(cst));
 
-      replace_holder(-1, get_code_len());
-      replace_holder(-2, update_p);
+      replace_holder(cst, -1, get_code_len(cst));
+      replace_holder(cst, -2, update_p);
       break;
     }
     case OUT:
     case GO:
-      if (!cst.loop) {
+      if (!cst->loop) {
+        TRACE_JUMP()
         fprintf(stderr,
                 "\033[1;31mcompiler %d:\033[0m Loop control \
 statement cannot be used outside loop.\n",
-                cst.pre.line);
+                cst->pre.line);
         exit(EXIT_SUCCESS);
       }
-      token_kind kind = cst.pre.kind;
-      iter();
-      if (cst.pre.kind == R_ARROW) {
-        emit_code(JUMP_TO);
+      token_kind kind = cst->pre.kind;
+      iter(cst);
+      if (cst->pre.kind == R_ARROW) {
+        emit_code(cst, JUMP_TO);
       } else {
-        set_precedence(P_LOWEST);
-        emit_code(T_JUMP_TO);
+        set_precedence(cst, P_LOWEST);
+        emit_code(cst, T_JUMP_TO);
       }
-      emit_offset(kind == OUT ? -1 : -2);
+      emit_jump(cst, kind == OUT ? -1 : -2);
       break;
     case RET:
-      iter();
-      if (cst.pre.kind == R_ARROW) {
-        emit_code(TO_RET);
+      iter(cst);
+      if (cst->pre.kind == R_ARROW) {
+        emit_code(cst, TO_RET);
       } else {
-        stmt();
-        emit_code(RET_OF);
+        code_object* code = BACK_CODE;
+        int begin = code->len;
+        cst->ret = true;
+        stmt(cst);
+        if (code->len == begin + CODE_SIZE(FUNCTION) &&
+            code->codes[begin] == FUNCTION) {
+          object* fn =
+              code->objects->data[READ_OFF(code->codes, begin + 1)];
+          emit_code(cst, LOAD_OF);
+          emit_name(cst, fn->value.fn.name);
+        }
+        emit_code(cst, RET_OF);
       }
       break;
     case USE: {
-      token_kind kind = cst.pre.kind;
-      iter();
-      bool internal = cst.pre.kind == L_ARROW;
+      token_kind kind = cst->pre.kind;
+      iter(cst);
+      bool internal = cst->pre.kind == L_ARROW;
       if (internal) {
-        iter();
+        iter(cst);
       }
-      if (cst.pre.kind != LITERAL) {
-        syntax_error();
+      if (cst->pre.kind != LITERAL) {
+        syntax_error(cst);
       }
-      emit_code(SET_NAME);
-      emit_name(cst.pre.literal);
+      emit_code(cst, SET_NAME);
+      emit_ident(cst, cst->pre);
       int count = 1;
-      while (cst.cur.kind == SLASH) {
-        both_iter();
-        if (cst.pre.kind != LITERAL) {
-          syntax_error();
+      while (cst->cur.kind == SLASH) {
+        both_iter(cst);
+        if (cst->pre.kind != LITERAL) {
+          syntax_error(cst);
         }
-        emit_code(SET_NAME);
-        emit_name(cst.pre.literal);
+        emit_code(cst, SET_NAME);
+        emit_ident(cst, cst->pre);
         count++;
       }
-      emit_code(internal ? USE_IN_MOD : USE_MOD);
-      emit_offset(count);
+      emit_code(cst, internal ? USE_IN_MOD : USE_MOD);
+      emit_offset(cst, count);
       break;
     }
     default:
-      set_precedence(P_LOWEST);
+      set_precedence(cst, P_LOWEST);
+      if (!ret) {
+        drop_value(cst);
+      }
   }
 }
 
-void block() {
-  token* tok = cst.tokens->data[cst.p - 1];
-  int off = cst.pre.off;
-  if (off <= tok->off) {
-    no_block_error();
+void block(compile_state* cst) {
+  int off = cst->pre.off;
+  if (off <= cst->back.off) {
+    no_block_error(cst);
   }
+  cst->nest++;
   while (true) {
-    stmt();
-    if (cst.cur.off == off) {
-      iter();
+    stmt(cst);
+    if (cst->cur.off == off) {
+      iter(cst);
     } else {
       break;
     }
   }
+  cst->nest--;
 }
 
-extern keg* compile(keg* t) {
-  p = 0;
-
-  cst.tokens = t;
-  cst.codes = NULL;
-  cst.p = 0;
-  clear_state();
+extern keg* compile(token_stream* t) {
+  compile_state state = {.tokens = t, .name_line = -1};
+  compile_state* cst = &state;
 
-  both_iter();
+  both_iter(cst);
 
   code_object* code = new_code("main");
   PUSH_CODE(code);
 
-  while (cst.pre.kind != EOH && !trace) {
-    stmt();
-    iter();
-    cst.loop = false;
+  while (cst->pre.kind != EOH && !trace) {
+    stmt(cst);
+    iter(cst);
+    cst->loop = false;
   }
-  emit_code(TO_RET);
-  return cst.codes;
+  emit_code(cst, TO_RET);
+  if (!trace) {
+    optimize(code);
+    if (!verify(code)) {
+      TRACE_JUMP()
+      fprintf(stderr, "\033[1;31mcompiler:\033[0m invalid bytecode.\n");
+      exit(EXIT_SUCCESS);
+    }
+  }
+  return cst->codes;
+}
+
+const char* var_string(code_object* code, int16_t v) {
+  char* str = malloc(sizeof(char) * DEBUG_OBJ_STR_CAP);
+  if (v < 0) {
+    snprintf(str, DEBUG_OBJ_STR_CAP, "$%s", (char*)code->locals->data[-1 - v]);
+  } else {
+    snprintf(str, DEBUG_OBJ_STR_CAP, "#%s", (char*)code->names->data[v]);
+  }
+  return str;
+}
+
+const char* reg_string(code_object* code, int16_t v) {
+  int i = R_INDEX(v);
+  int locals = code->locals == NULL ? 0 : code->locals->item;
+  if (R_KIND(v) == R_CONST) {
+    return obj_string(code->objects->data[i]);
+  }
+  char* str = malloc(sizeof(char) * DEBUG_OBJ_STR_CAP);
+  switch (R_KIND(v)) {
+    case R_REG:
+      if (i < locals) {
+        snprintf(str, DEBUG_OBJ_STR_CAP, "$%s", (char*)code->locals->data[i]);
+      } else {
+        snprintf(str, DEBUG_OBJ_STR_CAP, "r%d", i - locals);
+      }
+      break;
+    case R_NAME:
+      snprintf(str, DEBUG_OBJ_STR_CAP, "#%s", (char*)code->names->data[i]);
+      break;
+    default:
+      snprintf(str, DEBUG_OBJ_STR_CAP, "push");
+  }
+  return str;
 }
 
 extern void disassemble_code(code_object* code) {
-  printf("%s: %d code, %d name, %d type, %d object, %d offset\n",
-         code->description, code->codes == NULL ? 0 : code->codes->item,
-         code->names == NULL ? 0 : code->names->item,
-         code->types == NULL ? 0 : code->types->item,
-         code->objects == NULL ? 0 : code->objects->item,
-         code->offsets == NULL ? 0 : code->offsets->item);
-
-  for (int b = 0, p = 0, pl = -1; b < code->codes->item; b++) {
-    int line = *(int*)code->lines->data[b];
+  printf(
+      "%s: %d code, %d byte, %d stack, %d name, %d local, %d type, "
+      "%d object\n",
+      code->description, code->count, code->len, code->stack,
+      code->names == NULL ? 0 : code->names->item,
+      code->locals == NULL ? 0 : code->locals->item,
+      code->types == NULL ? 0 : code->types->item,
+      code->objects == NULL ? 0 : code->objects->item);
+
+  /* The line table is walked along with the code, one run at a time. */
+  int at = 0, run = 0, next = 0, line = 0;
+  bool more = next_line(&code->lines, &at, &run, &next);
+
+  for (int b = 0, p = 0, pl = -1; p < code->len; b++) {
+    while (more && run <= p) {
+      line = next;
+      more = next_line(&code->lines, &at, &run, &next);
+    }
     if (line != pl) {
-      printf("L%-4d", *(int*)code->lines->data[b]);
+      printf("L%-4d", line);
       pl = line;
     } else {
       printf("%-5s", " ");
     }
 
-    op_code* inner = code->codes->data[b];
-    printf("[%2d] %10s", b, code_string[*inner]);
+    uint8_t inner = code->codes[p];
+    printf("[%3d] %10s", p, code_string[inner]);
     printf("%-1c", ' ');
 
-    switch (*inner) {
+#define OFF(i) READ_OFF(code->codes, p + 1 + 2 * (i))
+#define JUMP(i) READ_JUMP(code->codes, p + 1 + 2 * (i))
+    switch (inner) {
       case CONST_OF:
       case ENUMERATE:
       case FUNCTION:
       case INTERFACE:
       case CLASS:
       case SET_EB: {
-        int16_t* off = code->offsets->data[p++];
-        object* obj = code->objects->data[*off];
-        printf("%d %s\n", *off, obj_string(obj));
+        object* obj = code->objects->data[OFF(0)];
+        printf("%d %s\n", OFF(0), obj_string(obj));
         break;
       }
-      case LOAD_OF:
       case GET_OF:
       case GET_IN_OF:
+      case REF_MODULE: {
+        char* name = code->names->data[OFF(0)];
+        printf("%d #%s %d\n", OFF(0), name, OFF(1));
+        break;
+      }
+      case LOAD_OF:
       case SET_OF:
       case ASSIGN_TO:
       case SET_NAME:
-      case REF_MODULE:
       case REF_SET: {
-        int16_t* off = code->offsets->data[p++];
-        char* name = code->names->data[*off];
-        if (*inner == SET_NAME)
-          printf("%d '%s'\n", *off, name);
+        char* name = code->names->data[OFF(0)];
+        if (inner == SET_NAME)
+          printf("%d '%s'\n", OFF(0), name);
         else
-          printf("%d #%s\n", *off, name);
+          printf("%d #%s\n", OFF(0), name);
         break;
       }
       case CALL_FUNC:
-      case NEW_OBJ:
+      case NEW_OBJ: {
+        printf("%d\n", OFF(0));
+        break;
+      }
       case JUMP_TO:
       case T_JUMP_TO:
       case F_JUMP_TO: {
-        int16_t* off = code->offsets->data[p++];
-        printf("%d\n", *off);
+        printf("%d\n", JUMP(0));
+        break;
+      }
+      case CHECK_TYPE: {
+        printf("%d %s\n", OFF(0), type_string(code->types->data[OFF(0)]));
         break;
       }
-      case STORE_NAME: {
-        int16_t* x = code->offsets->data[p];
-        int16_t* y = code->offsets->data[p + 1];
-        printf("%d %s %d '%s'\n", *x, type_string(code->types->data[*x]), *y,
-               code->names->data[*y]);
-        p += 2;
+      case STORE_NAME:
+      case U_STORE_NAME: {
+        printf("%d %s %d '%s'\n", OFF(0),
+               type_string(code->types->data[OFF(0)]), OFF(1),
+               (char*)code->names->data[OFF(1)]);
+        break;
+      }
+      case RANGE_OF: {
+        printf("%d #%s %d #%s %d\n", OFF(0), (char*)code->names->data[OFF(0)],
+               OFF(1), (char*)code->names->data[OFF(1)], JUMP(2));
         break;
       }
-      case RANGE_OF:
       case RANGE_GO: {
-        int16_t* x = code->offsets->data[p];
-        int16_t* y = code->offsets->data[p + 1];
-        printf("%d #%s %d\n", *x, code->names->data[*x], *y);
-        p += 2;
+        printf("%d #%s %d\n", OFF(0), (char*)code->names->data[OFF(0)],
+               JUMP(1));
+        break;
+      }
+      case LOAD_LOCAL:
+      case ASSIGN_LOCAL:
+      case U_ASSIGN_LOCAL: {
+        printf("%d $%s\n", OFF(0), (char*)code->locals->data[OFF(0)]);
+        break;
+      }
+      case STORE_LOCAL:
+      case U_STORE_LOCAL: {
+        printf("%d %s %d $%s\n", OFF(0),
+               type_string(code->types->data[OFF(0)]), OFF(1),
+               (char*)code->locals->data[OFF(1)]);
+        break;
+      }
+      case LOAD_CONST:
+      case ADD_TO: {
+        object* obj = code->objects->data[OFF(1)];
+        printf("%d %s %d %s\n", OFF(0), var_string(code, OFF(0)), OFF(1),
+               obj_string(obj));
+        break;
+      }
+      case LOAD_LOAD: {
+        printf("%d %s %d %s\n", OFF(0), var_string(code, OFF(0)), OFF(1),
+               var_string(code, OFF(1)));
+        break;
+      }
+      case LOAD_CALL: {
+        printf("%d %s %d\n", OFF(0), var_string(code, OFF(0)), OFF(1));
+        break;
+      }
+      case CMP_JUMP: {
+        printf("%s %d\n", code_string[OFF(0)], JUMP(1));
+        break;
+      }
+      case REG_BINARY: {
+        printf("%s %s %s %s\n", code_string[OFF(0)], reg_string(code, OFF(1)),
+               reg_string(code, OFF(2)), reg_string(code, OFF(3)));
+        break;
+      }
+      case REG_JUMP: {
+        printf("%s %s %s %d\n", code_string[OFF(0)], reg_string(code, OFF(1)),
+               reg_string(code, OFF(2)), JUMP(3));
         break;
       }
       case BUILD_ARR:
       case BUILD_TUP:
       case BUILD_MAP:
       case USE_MOD:
-      case USE_IN_MOD: {
-        int16_t* item = code->offsets->data[p++];
-        printf("%d\n", *item);
+      case USE_IN_MOD:
+      case DROP_TO: {
+        printf("%d\n", OFF(0));
         break;
       }
       default:
         printf("\n");
     }
+#undef OFF
+#undef JUMP
+    p += CODE_SIZE(inner);
   }
 
   if (code->objects != NULL) {
@@ -0,0 +1,233 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#include "gc.h"
+
+#include "vm.h"
+
+extern vm_state vst;
+
+bool gc_due = false;
+
+/* Modules are compiled on several threads, only the one running the
+ * program hands what it makes to the collector. */
+static __thread bool enabled = false;
+
+static keg* objects = NULL; /* made by the program */
+static keg* frames = NULL;  /* of class instances */
+static keg* pinned = NULL;
+static keg* gray = NULL; /* marked, what they hold not yet */
+
+/* Swept objects of the common size, linked through their first bytes and
+ * taken again before asking malloc. */
+static object* cells = NULL;
+
+static int made = 0;
+static int live = 0;
+
+/* Objects, frames and code objects found reachable by the running
+ * collection carry its number, so no mark has to be cleared. */
+static uint32_t epoch = 0;
+
+static void count_made() {
+  if (++made >= GC_MIN && made >= live) {
+    gc_due = true;
+  }
+}
+
+object* gc_alloc(size_t size) {
+  object* obj;
+  if (enabled && size == sizeof(object) && cells != NULL) {
+    obj = cells;
+    cells = *(object**)obj;
+  } else {
+    obj = malloc(size);
+  }
+  obj->mark = 0;
+  if (enabled) {
+    objects = append_keg(objects, obj);
+    count_made();
+  }
+  return obj;
+}
+
+bool gc_enable(bool on) {
+  bool up = enabled;
+  enabled = on;
+  return up;
+}
+
+void gc_pin(object* obj) {
+  pinned = append_keg(pinned, obj);
+}
+
+void gc_unpin(object* obj) {
+  for (int i = pinned == NULL ? -1 : pinned->item - 1; i >= 0; i--) {
+    if (pinned->data[i] == obj) {
+      remove_keg(pinned, i);
+      return;
+    }
+  }
+}
+
+void track_frame(frame* f) {
+  frames = append_keg(frames, f);
+  count_made();
+}
+
+static void mark(object* obj) {
+  if (obj == NULL || is_immediate(obj) || obj->mark == epoch) {
+    return;
+  }
+  obj->mark = epoch;
+  gray = append_keg(gray, obj);
+}
+
+static void mark_keg(keg* g) {
+  for (int i = 0; g != NULL && i < g->item; i++) {
+    mark(g->data[i]);
+  }
+}
+
+/* Constants are never collected, but functions and interfaces among them
+ * hold the instances they were last used with. */
+static void mark_code(code_object* code) {
+  if (code == NULL || code->mark == epoch) {
+    return;
+  }
+  code->mark = epoch;
+  mark_keg(code->objects);
+}
+
+static void mark_frame(frame* f) {
+  if (f == NULL || f->mark == epoch) {
+    return;
+  }
+  f->mark = epoch;
+  mark_code(f->code);
+  mark_keg(f->data);
+  mark_keg(f->tb->value);
+  for (int i = 0; i < f->slots; i++) {
+    mark(f->local[i]);
+  }
+  mark(f->ret);
+  mark(f->fn);
+  for (int i = 0; i < f->range->item; i++) {
+    mark(((range_iter*)f->range->data[i])->obj);
+  }
+}
+
+static void trace(object* obj) {
+  switch (obj->kind) {
+    case OBJ_ARRAY:
+      mark_keg(obj->value.arr.element);
+      break;
+    case OBJ_TUPLE:
+      mark_keg(obj->value.tup.element);
+      break;
+    case OBJ_MAP:
+      mark_keg(obj->value.map.k);
+      mark_keg(obj->value.map.v);
+      break;
+    case OBJ_FUNCTION:
+      mark_frame(obj->value.fn.self);
+      mark_code(obj->value.fn.code);
+      break;
+    case OBJ_CLASS:
+      mark_frame((frame*)obj->value.cl.fr);
+      mark_code(obj->value.cl.code);
+      break;
+    case OBJ_INTERFACE:
+      mark((object*)obj->value.in.class);
+      break;
+    case OBJ_MODULE:
+      mark_keg(((table*)obj->value.mod.tb)->value);
+      break;
+    case OBJ_EBLOCK:
+      mark_code(obj->value.eb.code);
+      break;
+  }
+}
+
+static void mark_frames(keg* g) {
+  for (int i = 0; g != NULL && i < g->item; i++) {
+    mark_frame(g->data[i]);
+  }
+}
+
+static void release(object* obj) {
+  switch (obj->kind) {
+    case OBJ_ARRAY:
+      if (obj->value.arr.element != NULL) {
+        free_keg(obj->value.arr.element);
+      }
+      break;
+    case OBJ_TUPLE:
+      if (obj->value.tup.element != NULL) {
+        free_keg(obj->value.tup.element);
+      }
+      break;
+    case OBJ_MAP:
+      free_keg(obj->value.map.k);
+      free_keg(obj->value.map.v);
+      break;
+    case OBJ_STRING:
+      /* Made with its bytes right after it, not of the common size. */
+      if (obj->value.str == (char*)(obj + 1)) {
+        free(obj);
+        return;
+      }
+      break;
+  }
+  *(object**)obj = cells;
+  cells = obj;
+}
+
+/* Frames of the modules being loaded are kept in up, the running one is
+ * in frame and call. */
+void collect() {
+  gc_due = false;
+  if (++epoch == 0) {
+    epoch = 1;
+  }
+  mark_frames(vst.frame);
+  mark_frames(vst.call);
+  for (int i = 0; vst.up != NULL && i < vst.up->item; i++) {
+    mark_frames(vst.up->data[i]);
+  }
+  mark_keg(pinned);
+  while (gray != NULL && gray->item > 0) {
+    trace(pop_back_keg(gray));
+  }
+
+  int n = 0;
+  for (int i = 0; objects != NULL && i < objects->item; i++) {
+    object* obj = objects->data[i];
+    if (obj->mark == epoch) {
+      objects->data[n++] = obj;
+    } else {
+      release(obj);
+    }
+  }
+  if (objects != NULL) {
+    objects->item = n;
+  }
+  live = n;
+
+  n = 0;
+  for (int i = 0; frames != NULL && i < frames->item; i++) {
+    frame* f = frames->data[i];
+    if (f->mark == epoch) {
+      frames->data[n++] = f;
+    } else {
+      free_frame(f);
+    }
+  }
+  if (frames != NULL) {
+    frames->item = n;
+  }
+  live += n;
+  made = 0;
+}
@@ -0,0 +1,38 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#ifndef FT_GC_H
+#define FT_GC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "object.h"
+
+/* Objects and frames made since the last collection before the next one is
+ * due, at least. It grows with what survived the last one. */
+#ifndef GC_MIN
+#define GC_MIN 65536
+#endif
+
+/* Set once enough was made, the virtual machine collects before its next
+ * instruction, where every value it holds is in a frame. */
+extern bool gc_due;
+
+/* Memory for an object of size bytes, at least sizeof(object). It belongs
+ * to the collector when made by the running program, anything else lives
+ * as long as the code it was made for. */
+object* gc_alloc(size_t);
+
+/* Whether what this thread makes belongs to the collector, the previous
+ * setting is returned. It is off while compiling, constants are kept. */
+bool gc_enable(bool);
+
+/* Roots for objects only C code holds on to, a C module pins an object it
+ * keeps between calls and unpins it when done. */
+void gc_pin(object*);
+void gc_unpin(object*);
+
+#endif
@@ -3,13 +3,24 @@
  * 	- https://drift-lang.fun/
  *
  * GPL v3 License - bingxio <bingxio@qq.com> */
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#include "keg.h"
 #include "token.h"
 #include "trace.h"
 
+/* Sources at least twice this long are split into parts of at least this
+ * size when split_lex is set, one for each worker. */
+#define SPLIT_MIN (128 * 1024)
+#define SPLIT_MAX 8
+
+extern bool split_lex;
+
 static inline bool is_space(char c) {
   return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\0';
 }
@@ -22,29 +33,185 @@ static inline bool is_ident(char c) {
   return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
 }
 
-token_kind to_keyword(const char* literal) {
-  for (int i = 36; i < 48; i++) {
-    if (strcmp(literal, token_string[i]) == 0) {
-      return i;
+/* Runs of spaces, identifiers, digits and string bodies are scanned 16
+ * bytes at a time where SSE2 is available. A mask has the bit of every byte
+ * of the block that is in the class set, and the first byte out of it ends
+ * the run. The rest of a run shorter than a block is scanned bytewise. */
+#ifdef __SSE2__
+static inline __m128i block_at(const char* p) {
+  return _mm_loadu_si128((const __m128i*)p);
+}
+
+static inline int byte_mask(__m128i v, char c) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+/* Bytes from lo to hi. Bytes above 127 compare as negative and so are out
+ * of every range. */
+static inline __m128i in_range(__m128i v, char lo, char hi) {
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                       _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+static inline int space_mask(__m128i v) {
+  return byte_mask(v, ' ') | byte_mask(v, '\t') | byte_mask(v, '\n') |
+         byte_mask(v, '\r') | byte_mask(v, '\0');
+}
+
+/* Upper case letters are folded into lower case ones. */
+static inline int ident_mask(__m128i v) {
+  __m128i l = in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+  return _mm_movemask_epi8(l) | byte_mask(v, '_');
+}
+
+static inline int number_mask(__m128i v) {
+  return _mm_movemask_epi8(in_range(v, '0', '9')) | byte_mask(v, '.');
+}
+
+/* Bits of the mask below the first clear one of the run, which is not
+ * zero. */
+static inline int before(int mask, int run) {
+  return mask & ((1 << __builtin_ctz(~run & 0xffff)) - 1);
+}
+#endif
+
+/* Index of the first byte from i on that is not a space. The newlines
+ * passed are added to lines and the last of them stored in last. */
+static int skip_space(const char* buf, int i, int fsize, int* lines,
+                      int* last) {
+  /* Most runs are a single space between tokens. */
+  if (buf[i] == ' ' && i + 1 < fsize && !is_space(buf[i + 1])) {
+    return i + 1;
+  }
+#ifdef __SSE2__
+  for (; i + 16 <= fsize; i += 16) {
+    __m128i v = block_at(buf + i);
+    int run = space_mask(v);
+    int nl = byte_mask(v, '\n');
+    if (run != 0xffff) {
+      nl = before(nl, run);
+    }
+    if (nl != 0) {
+      *lines += __builtin_popcount(nl);
+      *last = i + 31 - __builtin_clz(nl);
+    }
+    if (run != 0xffff) {
+      return i + __builtin_ctz(~run);
     }
   }
-  return LITERAL;
+#endif
+  for (; i < fsize && is_space(buf[i]); i++) {
+    if (buf[i] == '\n') {
+      (*lines)++;
+      *last = i;
+    }
+  }
+  return i;
+}
+
+static int skip_ident(const char* buf, int i, int fsize) {
+#ifdef __SSE2__
+  for (; i + 16 <= fsize; i += 16) {
+    int run = ident_mask(block_at(buf + i));
+    if (run != 0xffff) {
+      return i + __builtin_ctz(~run);
+    }
+  }
+#endif
+  while (i < fsize && is_ident(buf[i])) {
+    i++;
+  }
+  return i;
+}
+
+static int skip_number(const char* buf, int i, int fsize) {
+#ifdef __SSE2__
+  for (; i + 16 <= fsize; i += 16) {
+    int run = number_mask(block_at(buf + i));
+    if (run != 0xffff) {
+      return i + __builtin_ctz(~run);
+    }
+  }
+#endif
+  while (i < fsize && (is_digit(buf[i]) || buf[i] == '.')) {
+    i++;
+  }
+  return i;
 }
 
-token* new_token(token_kind k, char* literal, int line, int off) {
-  token* tok = malloc(sizeof(token));
-  tok->kind = k;
-  tok->literal = literal;
-  tok->line = line;
-  tok->off = off;
-  return tok;
+/* Index of the quote that closes a string body starting at i, or fsize.
+ * The newlines in the body are added to lines. */
+static int skip_string(const char* buf, int i, int fsize, int* lines) {
+#ifdef __SSE2__
+  for (; i + 16 <= fsize; i += 16) {
+    __m128i v = block_at(buf + i);
+    int quote = byte_mask(v, '"');
+    int nl = byte_mask(v, '\n');
+    if (quote != 0) {
+      *lines += __builtin_popcount(before(nl, ~quote));
+      return i + __builtin_ctz(quote);
+    }
+    *lines += __builtin_popcount(nl);
+  }
+#endif
+  for (; i < fsize && buf[i] != '"'; i++) {
+    if (buf[i] == '\n') {
+      (*lines)++;
+    }
+  }
+  return i;
 }
 
-bool next(const char* buf, int* p, char c) {
-  if (*p + 1 > strlen(buf)) {
-    return false;
+/* Keywords are told apart by their first letter, and "n" words by their
+ * length and second letter, so at most one of them is compared. */
+token_kind to_keyword(const char* literal, int len) {
+  if (len < 2 || len > 3) {
+    return LITERAL;
   }
-  if (buf[*p + 1] == c) {
+  token_kind k;
+  switch (literal[0]) {
+    case 'a':
+      k = AOP;
+      break;
+    case 'd':
+      k = DEF;
+      break;
+    case 'e':
+      k = EF;
+      break;
+    case 'f':
+      k = FOR;
+      break;
+    case 'g':
+      k = GO;
+      break;
+    case 'i':
+      k = IF;
+      break;
+    case 'n':
+      k = len == 2 ? NF : literal[1] == 'e' ? NEW : NIL;
+      break;
+    case 'o':
+      k = OUT;
+      break;
+    case 'r':
+      k = RET;
+      break;
+    case 'u':
+      k = USE;
+      break;
+    default:
+      return LITERAL;
+  }
+  const char* word = token_string[k];
+  if (strncmp(literal, word, len) == 0 && word[len] == '\0') {
+    return k;
+  }
+  return LITERAL;
+}
+
+bool next(const char* buf, int fsize, int* p, char c) {
+  if (*p + 1 < fsize && buf[*p + 1] == c) {
     *p += 2;
     return true;
   }
@@ -52,35 +219,62 @@ bool next(const char* buf, int* p, char c) {
   return false;
 }
 
-void paste_literal(char* literal, const char* buf, int* p, int i) {
-  for (int x = 0, j = *p; x < j; x++) {
-    literal[x] = buf[i - *p];
-    (*p)--;
-    if (x + 1 == j) {
-      literal[x + 1] = '\0';
+static void split_stream(token_stream*);
+
+extern token_stream new_stream(const char* buf, int fsize) {
+  token_stream s = {
+      .src = buf, .size = fsize, .line = 1, .new_line = true, .last = -1};
+  if (split_lex && fsize >= SPLIT_MIN * 2) {
+    split_stream(&s);
+  }
+  return s;
+}
+
+/* Next of the tokens lexed ahead. The chunks are freed as they are used
+ * up, and after the last one the stream is done. */
+static bool next_ahead(token_stream* s, token* t) {
+  while (s->chunk < s->count) {
+    token_chunk* c = &s->chunks[s->chunk];
+    if (s->at < c->item) {
+      *t = c->data[s->at++];
+      t->line += c->base;
+      s->last = t->line;
+      return true;
     }
+    free(c->data);
+    s->chunk++;
+    s->at = 0;
   }
+  free(s->chunks);
+  s->chunks = NULL;
+  s->done = true;
+  return false;
 }
 
-extern keg* lexer(const char* buf, int fsize) {
-  keg* tokens = NULL;
-  bool new_line = true;
-  for (int i = 0, line = 1, off = 0; i < fsize;) {
-    char c = buf[i];
-    while (is_space(c)) {
-      if (c == '\n') {
-        line++;
-        off = -1;
+/* The token after the ones made so far. Once the source ends or has an
+ * error, it is EOH every time. */
+extern token next_token(token_stream* s) {
+  token t;
+  if (s->chunks != NULL && next_ahead(s, &t)) {
+    return t;
+  }
+  const char* buf = s->src;
+  int fsize = s->size;
+  int i = s->i;
+  int line = s->line;
+  int off = s->off;
+  bool new_line = s->new_line;
+  while (!s->done && i < fsize) {
+    if (is_space(buf[i])) {
+      int last = -1;
+      int j = skip_space(buf, i, fsize, &line, &last);
+      if (last != -1) {
+        off = j - last - 1;
         new_line = true;
+      } else if (new_line) {
+        off += j - i;
       }
-      if (i + 1 >= fsize) {
-        ++i;
-        break;
-      }
-      c = buf[++i];
-      if (new_line) {
-        off++;
-      }
+      i = j;
     }
     if (i >= fsize) {
       break;
@@ -88,89 +282,63 @@ extern keg* lexer(const char* buf, int fsize) {
     if (new_line) {
       new_line = false;
     }
+    char c = buf[i];
     if (is_digit(c)) {
-      int p = 0;
-      bool f = false;
-      while (is_digit(c) || c == '.') {
-        if (c == '.') {
-          f = true;
-        }
-        p++;
-        c = buf[++i];
-      }
-      char* literal = malloc((p + 1) * sizeof(char));
-      paste_literal(literal, buf, &p, i);
-
-      token* tok = new_token(f ? FLOAT : NUMBER, literal, line, off);
-      tokens = append_keg(tokens, tok);
-      continue;
+      int start = i;
+      i = skip_number(buf, i, fsize);
+      bool f = memchr(buf + start, '.', i - start) != NULL;
+      t = (token){f ? FLOAT : NUMBER, start, i - start, line, off};
+      goto out;
     }
     if (is_ident(c)) {
-      int p = 0;
-      while (is_ident(c)) {
-        p++;
-        c = buf[++i];
-      }
-      char* literal = malloc((p + 1) * sizeof(char));
-      paste_literal(literal, buf, &p, i);
-
-      token* tok = new_token(to_keyword(literal), literal, line, off);
-      tokens = append_keg(tokens, tok);
-      continue;
+      int start = i;
+      i = skip_ident(buf, i, fsize);
+      token_kind k = to_keyword(buf + start, i - start);
+      t = (token){k, start, i - start, line, off};
+      goto out;
     }
-    token t = {.line = line, .off = off};
+    t = (token){.start = i, .line = line, .off = off};
     switch (c) {
       case '+':
         i++;
         t.kind = ADD;
-        t.literal = "+";
         break;
       case '-':
-        if (next(buf, &i, '>')) {
+        if (next(buf, fsize, &i, '>')) {
           t.kind = R_ARROW;
-          t.literal = "->";
         } else {
           t.kind = SUB;
-          t.literal = "-";
         }
         break;
       case '*':
         i++;
         t.kind = MUL;
-        t.literal = "*";
         break;
       case '/':
         i++;
         t.kind = DIV;
-        t.literal = "/";
         break;
       case '%':
         i++;
         t.kind = SUR;
-        t.literal = "%";
         break;
       case '<':
-        if (next(buf, &i, '=')) {
+        if (next(buf, fsize, &i, '=')) {
           t.kind = LE_EQ;
-          t.literal = "<=";
         } else {
-          if (buf[i] == '-') {
+          if (i < fsize && buf[i] == '-') {
             t.kind = L_ARROW;
-            t.literal = "<-";
             i++;
           } else {
             t.kind = LESS;
-            t.literal = "<";
           }
         }
         break;
       case '>':
-        if (next(buf, &i, '=')) {
+        if (next(buf, fsize, &i, '=')) {
           t.kind = GR_EQ;
-          t.literal = ">=";
         } else {
           t.kind = GREATER;
-          t.literal = ">";
         }
         break;
       case ' ':
@@ -180,165 +348,292 @@ extern keg* lexer(const char* buf, int fsize) {
       case '\0':
         continue;
       case '#':
-        while (buf[++i] != '\n')
+        while (++i < fsize && buf[i] != '\n')
           ;
         continue;
       case '\'': {
-        i++;
-        char* literal = malloc(sizeof(char));
-        literal[0] = buf[i++];
-        c = buf[i];
-        if (c != '\'') {
+        t.start = ++i;
+        if (i + 1 >= fsize || buf[i + 1] != '\'') {
           TRACE(
               "\033[1;31mlexer %d:\033[0m missing single quotation "
               "mark to the right.\n",
               line)
-          goto out;
-        } else {
-          i += 1;
+          goto end;
         }
+        i += 2;
         t.kind = CHAR;
-        t.literal = literal;
+        t.len = 1;
       } break;
       case '"': {
-        c = buf[++i];
-        int p = 0;
-        while (c != '"') {
-          c = buf[++i];
-          p++;
-          if (i == fsize) {
-            TRACE(
-                "\033[1;31mlexer %d:\033[0m missing closing double "
-                "quote.\n",
-                line)
-            goto out;
-          }
-        }
-        char* literal;
-        if (p == 0) {
-          literal = "";
-        } else {
-          literal = malloc((p + 1) * sizeof(char));
-          paste_literal(literal, buf, &p, i);
-        }
-        for (int i = 0; i < strlen(literal); i++) {
-          if (literal[i] == '\n') {
-            line++;
-          }
+        int lines = 0;
+        t.start = ++i;
+        i = skip_string(buf, i, fsize, &lines);
+        if (i == fsize) {
+          TRACE(
+              "\033[1;31mlexer %d:\033[0m missing closing double "
+              "quote.\n",
+              line)
+          goto end;
         }
-        i++;
+        t.len = i++ - t.start;
         t.kind = STRING;
-        t.literal = literal;
+        line += lines;
       } break;
       case '.':
         i++;
         t.kind = DOT;
-        t.literal = ".";
         break;
       case ',':
         i++;
         t.kind = COMMA;
-        t.literal = ",";
         break;
       case ':':
-        if (next(buf, &i, ':')) {
+        if (next(buf, fsize, &i, ':')) {
           t.kind = REF;
-          t.literal = "::";
         } else {
           t.kind = COLON;
-          t.literal = ":";
         }
         break;
       case '=':
-        if (next(buf, &i, '=')) {
+        if (next(buf, fsize, &i, '=')) {
           t.kind = EQ_EQ;
-          t.literal = "==";
         } else {
           t.kind = EQ;
-          t.literal = "=";
         }
         break;
       case ';':
         i++;
         t.kind = SEMICOLON;
-        t.literal = ";";
         break;
       case '&':
         i++;
         t.kind = ADDR;
-        t.literal = "&";
         break;
       case '|':
         i++;
         t.kind = OR;
-        t.literal = "|";
         break;
       case '!':
-        if (next(buf, &i, '=')) {
+        if (next(buf, fsize, &i, '=')) {
           t.kind = BANG_EQ;
-          t.literal = "!=";
         } else {
           t.kind = BANG;
-          t.literal = "!";
         }
         break;
       case '{':
         i++;
         t.kind = L_BRACE;
-        t.literal = "{";
         break;
       case '}':
         i++;
         t.kind = R_BRACE;
-        t.literal = "}";
         break;
       case '[':
         i++;
         t.kind = L_BRACKET;
-        t.literal = "[";
         break;
       case ']':
         i++;
         t.kind = R_BRACKET;
-        t.literal = "]";
         break;
       case '(':
         i++;
         t.kind = L_PAREN;
-        t.literal = "(";
         break;
       case ')':
         i++;
         t.kind = R_PAREN;
-        t.literal = ")";
         break;
       case '\\':
         i++;
         t.kind = SLASH;
-        t.literal = "\\";
         break;
       default:
         TRACE("\033[1;31mlexer %d:\033[0m unknown character '%c' ASCII %d.\n",
               line, c, c)
-        goto out;
+        goto end;
     }
-    tokens = append_keg(tokens, new_token(t.kind, t.literal, t.line, t.off));
-  }
-  if (tokens != NULL) {
-    token* end = back_keg(tokens);
-    token* eoh = new_token(EOH, "EOF", end->line + 1, 0);
-    tokens = append_keg(tokens, eoh);
-  } else {
-    tokens = append_keg(tokens, new_token(EOH, "EOF", 0, 0));
+    if (t.kind != CHAR && t.kind != STRING) {
+      t.len = i - t.start;
+    }
+    goto out;
   }
+end:
+  s->done = true;
+  t = (token){EOH, fsize, 0, s->last == -1 ? 0 : s->last + 1, 0};
+  return t;
 out:
-  return tokens;
+  s->i = i;
+  s->line = line;
+  s->off = off;
+  s->new_line = new_line;
+  s->last = t.line;
+  return t;
 }
 
-extern void disassemble_token(keg* tokens) {
-  for (int i = 0; i < tokens->item; i++) {
-    token* t = tokens->data[i];
-    printf("[%3d]\t%-5d %-5d %-5d %-30s\n", i, t->kind, t->line, t->off,
-           t->literal);
+/* A source is split after newlines into parts that are lexed at once,
+ * each as if it began a line of its own. That holds unless a token of the
+ * part before, a string most likely, runs over the split. The part is then
+ * lexed again from the end of that token once the parts before are done.
+ * So is a part that had an error, for it to be reported at its line. */
+typedef struct {
+  const char* src;
+  int size;
+  int from;
+  int to;
+  token_chunk out;  /* tokens that begin in the part */
+  token_stream end; /* after the last of them */
+  bool failed;
+  bool started; /* on a thread of its own */
+} split_job;
+
+static void add_token(token_chunk* c, token t) {
+  if (c->item + 1 > c->cap) {
+    c->cap = c->cap == 0 ? 256 : c->cap * 2;
+    c->data = realloc(c->data, sizeof(token) * c->cap);
   }
-}
\ No newline at end of file
+  c->data[c->item++] = t;
+}
+
+/* Lexes the tokens that begin before to, leaving s after the last one. */
+static void lex_until(token_stream* s, int to, token_chunk* out) {
+  while (true) {
+    token_stream before = *s;
+    token t = next_token(s);
+    if (t.kind == EOH || t.start >= to) {
+      *s = before;
+      return;
+    }
+    add_token(out, t);
+  }
+}
+
+static int count_lines(const char* buf, int from, int to) {
+  int n = 0;
+  const char* p = buf + from;
+  const char* end = buf + to;
+  while ((p = memchr(p, '\n', end - p)) != NULL) {
+    n++;
+    p++;
+  }
+  return n;
+}
+
+static void* lex_part(void* arg) {
+  split_job* j = arg;
+  jmp_buf* up = trace_jump;
+  jmp_buf env;
+  if (setjmp(env) != 0) {
+    trace_jump = up;
+    j->failed = true;
+    return NULL;
+  }
+  trace_jump = &env;
+  /* Lines are counted from the start of the part. */
+  token_stream s = {.src = j->src,
+                    .size = j->size,
+                    .i = j->from,
+                    .new_line = true,
+                    .last = -1};
+  lex_until(&s, j->to, &j->out);
+  j->end = s;
+  trace_jump = up;
+  return NULL;
+}
+
+static void split_stream(token_stream* s) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int n = s->size / SPLIT_MIN;
+  if (n > cpus) {
+    n = cpus;
+  }
+  if (n > SPLIT_MAX) {
+    n = SPLIT_MAX;
+  }
+  if (n < 2) {
+    return;
+  }
+  split_job* jobs = calloc(n, sizeof(split_job));
+  int count = 0;
+  for (int k = 0, from = 0; k < n && from < s->size; k++) {
+    int to = s->size;
+    if (k + 1 < n) {
+      int at = (long)s->size * (k + 1) / n;
+      const char* nl = at > from ? memchr(s->src + at, '\n', s->size - at)
+                                 : NULL;
+      to = nl == NULL ? s->size : nl - s->src + 1;
+    }
+    jobs[count++] =
+        (split_job){.src = s->src, .size = s->size, .from = from, .to = to};
+    from = to;
+  }
+  pthread_t* threads = malloc(sizeof(pthread_t) * count);
+  for (int k = 1; k < count; k++) {
+    jobs[k].started =
+        pthread_create(&threads[k], NULL, lex_part, &jobs[k]) == 0;
+  }
+  for (int k = 0; k < count; k++) {
+    if (!jobs[k].started) {
+      lex_part(&jobs[k]);
+    }
+  }
+  for (int k = 1; k < count; k++) {
+    if (jobs[k].started) {
+      pthread_join(threads[k], NULL);
+    }
+  }
+  free(threads);
+
+  s->chunks = malloc(sizeof(token_chunk) * count);
+  s->count = count;
+  /* Line of the whole source where the part begins, and the state to
+   * go on from when a token ran over the split before it. */
+  int line = 1;
+  bool over = false;
+  token_stream from;
+  for (int k = 0; k < count; k++) {
+    split_job* j = &jobs[k];
+    int end_line;
+    if (j->failed || over) {
+      token_stream t = from;
+      if (!over) {
+        t = (token_stream){.src = s->src,
+                           .size = s->size,
+                           .i = j->from,
+                           .line = line,
+                           .new_line = true,
+                           .last = -1};
+      }
+      free(j->out.data);
+      j->out = (token_chunk){NULL, 0, 0, 0};
+      lex_until(&t, j->to, &j->out);
+      j->end = t;
+      end_line = t.line;
+    } else {
+      j->out.base = line;
+      end_line = line + j->end.line;
+    }
+    over = j->end.i > j->to;
+    if (over) {
+      from = j->end;
+      from.line = end_line;
+    } else {
+      line = end_line + count_lines(s->src, j->end.i, j->to);
+    }
+    s->chunks[k] = j->out;
+  }
+  free(jobs);
+}
+
+extern void disassemble_token(token_stream* s) {
+  for (int i = 0; !s->done; i++) {
+    token t = next_token(s);
+    if (t.kind == EOH) {
+      printf("[%3d]\t%-5d %-5d %-5d %-30s\n", i, t.kind, t.line, t.off,
+             token_string[EOH]);
+      continue;
+    }
+    printf("[%3d]\t%-5d %-5d %-5d %-30.*s\n", i, t.kind, t.line, t.off,
+           t.len, s->src + t.start);
+  }
+}
@@ -0,0 +1,64 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#include "line.h"
+
+#include <stdlib.h>
+
+static void put_varint(line_table* t, uint32_t v) {
+  do {
+    if (t->len + 1 > t->cap) {
+      t->cap = t->cap == 0 ? 8 : t->cap * 2;
+      t->data = realloc(t->data, sizeof(uint8_t) * t->cap);
+    }
+    t->data[t->len++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+    v >>= 7;
+  } while (v != 0);
+}
+
+static uint32_t get_varint(line_table* t, int* at) {
+  uint32_t v = 0;
+  for (int s = 0; *at < t->len; s += 7) {
+    uint8_t b = t->data[(*at)++];
+    v |= (uint32_t)(b & 0x7f) << s;
+    if ((b & 0x80) == 0) {
+      break;
+    }
+  }
+  return v;
+}
+
+/* Records that the instruction at pc belongs to line. Instructions must be
+ * added in the order of their offsets. */
+void add_line(line_table* t, int pc, int line) {
+  if (t->len != 0 && line == t->line) {
+    return;
+  }
+  int d = line - t->line;
+  put_varint(t, pc - t->pc);
+  put_varint(t, (uint32_t)d << 1 ^ (uint32_t)(d >> 31));
+  t->pc = pc;
+  t->line = line;
+}
+
+/* Decodes the run at *at, moving pc and line on to its start and line. */
+bool next_line(line_table* t, int* at, int* pc, int* line) {
+  if (*at >= t->len) {
+    return false;
+  }
+  *pc += get_varint(t, at);
+  uint32_t d = get_varint(t, at);
+  *line += (int)(d >> 1) ^ -(int)(d & 1);
+  return true;
+}
+
+/* Line of the instruction that contains the byte at pc. */
+int find_line(line_table* t, int pc) {
+  int at = 0, p = 0, line = 0, found = 0;
+  while (next_line(t, &at, &p, &line) && p <= pc) {
+    found = line;
+  }
+  return found;
+}
@@ -0,0 +1,29 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#ifndef FT_LINE_H
+#define FT_LINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Line numbers of a code object as runs. A run is only recorded where the
+ * line changes, as the distance in bytes from the previous run followed by
+ * the line difference, both variable-length encoded. */
+typedef struct {
+  uint8_t* data;
+  int len;
+  int cap;
+  int pc;   /* start of the last run while appending */
+  int line; /* line of the last run while appending */
+} line_table;
+
+void add_line(line_table*, int, int);
+
+bool next_line(line_table*, int*, int*, int*);
+
+int find_line(line_table*, int);
+
+#endif
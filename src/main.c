@@ -3,6 +3,10 @@
  * 	- https://drift-lang.fun/
  *
  * GPL v3 License - bingxio <bingxio@qq.com> */
+#include "cache.h"
+#include "optimize.h"
+#include "preload.h"
+#include "source.h"
 #include "token.h"
 #include "vm.h"
 
@@ -13,59 +17,75 @@ bool show_tokens;
 bool show_bytes;
 bool show_tb;
 bool repl_mode;
+bool reg_mode;
+bool no_inline;
+bool split_lex;
 
-extern keg* lexer(const char*, int);
-extern keg* compile(keg*);
+extern token_stream new_stream(const char*, int);
+extern token next_token(token_stream*);
+extern keg* compile(token_stream*);
 
 extern void disassemble_code(code_object*);
-extern void disassemble_token(keg*);
+extern void disassemble_token(token_stream*);
 
-bool trace;
+__thread bool trace;
 
-void run(char* source, int fsize, char* filename) {
-  keg* tokens = lexer(source, fsize);
-  free(source);
-
-  if (show_tokens) {
-    disassemble_token(tokens);
-    return;
-  }
-
-  keg* codes = compile(tokens);
+void exec(code_object* code, const char* path) {
   if (show_bytes) {
-    disassemble_code(codes->data[0]);
+    disassemble_code(code);
     return;
   }
+  preload(code, path);
 
-  vm_state state = evaluate(codes->data[0], filename);
+  vm_state state = evaluate(code, get_filename(path));
   if (show_tb) {
     frame* main = state.frame->data[0];
     disassemble_table(main->tb, main->code->description);
   }
 
-  free_keg(codes);
   free(state.filename);
+}
+
+void run(source* src, const char* path) {
+  token_stream tokens = new_stream(src->buf, src->size);
+
+  if (show_tokens) {
+    disassemble_token(&tokens);
+    close_source(src);
+    return;
+  }
 
-  free_tokens(tokens);
+  keg* codes = compile(&tokens);
+  dump_cache(path, src, codes->data[0]);
+  close_source(src);
+
+  exec(codes->data[0], path);
+
+  free_keg(codes);
 }
 
 static vm_state state;
 
 void run_repl(char* line, int size) {
-  keg* tokens = lexer(line, size);
+  /* A line is short, it is lexed through first so that a lexer error does
+   * not leave the compiler in the middle of a statement. */
+  token_stream tokens = new_stream(line, size);
+  while (!tokens.done) {
+    next_token(&tokens);
+  }
   if (trace) {
     return;
   }
 
-  keg* codes = compile(tokens);
+  tokens = new_stream(line, size);
+  keg* codes = compile(&tokens);
   if (trace) {
     return;
   }
+  free(line);
 
   state = evaluate(codes->data[0], "REPL");
 
-  free(line);
-  free_tokens(tokens);
   free_keg(codes);
 }
 
@@ -77,7 +97,10 @@ command: \n\
   repl        enter read-eval-print-loop mode\n\
   token       show lexical token list\n\
   op          show bytecode\n\
-  tb          after exec, show environment mapping\n\n\
+  tb          after exec, show environment mapping\n\
+  reg         compile arithmetic to register instructions\n\
+  noinline    do not inline calls of small functions\n\
+  split       lex large sources in parts on several threads\n\n\
 version:  %s\n\
 license:  %s\n\
            @ bingxio - bingxio@qq.com\n",
@@ -140,13 +163,19 @@ int main(int argc, char** argv) {
     repl();
     return 0;
   }
-  if (argc == 3) {
-    if (strcmp(argv[2], "token") == 0)
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "token") == 0)
       show_tokens = true;
-    if (strcmp(argv[2], "op") == 0)
+    if (strcmp(argv[i], "op") == 0)
       show_bytes = true;
-    if (strcmp(argv[2], "tb") == 0)
+    if (strcmp(argv[i], "tb") == 0)
       show_tb = true;
+    if (strcmp(argv[i], "reg") == 0)
+      reg_mode = true;
+    if (strcmp(argv[i], "noinline") == 0)
+      no_inline = true;
+    if (strcmp(argv[i], "split") == 0)
+      split_lex = true;
   }
   const char* path = argv[1];
   int len = strlen(path) - 1;
@@ -154,23 +183,19 @@ int main(int argc, char** argv) {
     fprintf(stderr, "\033[1;31merror:\033[0m no input file.\n");
     exit(EXIT_SUCCESS);
   }
-  FILE* fp = fopen(path, "r");
-  if (fp == NULL) {
+  if (!show_tokens) {
+    code_object* code = load_cache(path);
+    if (code != NULL) {
+      exec(code, path);
+      return 0;
+    }
+  }
+  source src;
+  if (!open_source(path, &src)) {
     printf("\033[1;31merror:\033[0m failed to read buffer of file: '%s'\n",
            path);
     exit(EXIT_SUCCESS);
   }
-
-  fseek(fp, 0, SEEK_END);
-  int fsize = ftell(fp);
-  rewind(fp);
-  char* buf = malloc(fsize + 1);
-
-  fread(buf, sizeof(char), fsize, fp);
-  buf[fsize] = '\0';
-
-  run(buf, fsize, get_filename(path));
-
-  fclose(fp);
+  run(&src, path);
   return 0;
 }
@@ -5,23 +5,57 @@
  * GPL v3 License - bingxio <bingxio@qq.com> */
 #include "object.h"
 
+#include <pthread.h>
+
+#include "gc.h"
+
+static object small_ints[SMALL_INT_MAX - SMALL_INT_MIN + 1];
+static object bools[2] = {{.kind = OBJ_BOOL, .value.b = false},
+                          {.kind = OBJ_BOOL, .value.b = true}};
+static object nil = {.kind = OBJ_NIL};
+
+/* Constants are boxed while modules are compiled on several threads. */
+static pthread_once_t ints_once = PTHREAD_ONCE_INIT;
+
+static void fill_ints() {
+  for (int i = SMALL_INT_MIN; i <= SMALL_INT_MAX; i++) {
+    small_ints[i - SMALL_INT_MIN].kind = OBJ_INT;
+    small_ints[i - SMALL_INT_MIN].value.num = i;
+  }
+}
+
+/* The shared instance of a small int, NULL for the others. */
+static object* small_int(int num) {
+  if (num < SMALL_INT_MIN || num > SMALL_INT_MAX) {
+    return NULL;
+  }
+  pthread_once(&ints_once, fill_ints);
+  return &small_ints[num - SMALL_INT_MIN];
+}
+
+bool immortal(object* obj) {
+  return obj == &nil || (obj >= bools && obj < bools + 2) ||
+         (obj >= small_ints &&
+          obj < small_ints + (SMALL_INT_MAX - SMALL_INT_MIN + 1));
+}
+
 const char* obj_string(object* obj) {
   char* str = malloc(sizeof(char) * DEBUG_OBJ_STR_CAP);
-  switch (obj->kind) {
+  switch (kind_of(obj)) {
     case OBJ_INT:
-      sprintf(str, "int %d", obj->value.num);
+      sprintf(str, "int %d", num_of(obj));
       return str;
     case OBJ_FLOAT:
-      sprintf(str, "float %f", obj->value.f);
+      sprintf(str, "float %f", float_of(obj));
       return str;
     case OBJ_STRING:
       sprintf(str, "string \"%s\"", obj->value.str);
       return str;
     case OBJ_CHAR:
-      sprintf(str, "char '%c'", obj->value.c);
+      sprintf(str, "char '%c'", char_of(obj));
       return str;
     case OBJ_BOOL:
-      sprintf(str, "bool %s", obj->value.b ? "true" : "false");
+      sprintf(str, "bool %s", bool_of(obj) ? "true" : "false");
       return str;
     case OBJ_NIL:
       sprintf(str, "nil");
@@ -70,21 +104,21 @@ const char* obj_string(object* obj) {
 
 const char* obj_raw_string(object* obj, bool multiple) {
   char* str = malloc(sizeof(char) * STRING_CAP_MAX);
-  switch (obj->kind) {
+  switch (kind_of(obj)) {
     case OBJ_INT:
-      sprintf(str, "%d", obj->value.num);
+      sprintf(str, "%d", num_of(obj));
       return str;
     case OBJ_FLOAT:
-      sprintf(str, "%f", obj->value.f);
+      sprintf(str, "%f", float_of(obj));
       return str;
     case OBJ_STRING:
       sprintf(str, "%s", obj->value.str);
       return str;
     case OBJ_CHAR:
-      sprintf(str, "%c", obj->value.c);
+      sprintf(str, "%c", char_of(obj));
       return str;
     case OBJ_BOOL:
-      sprintf(str, "%s", obj->value.b ? "true" : "false");
+      sprintf(str, "%s", bool_of(obj) ? "true" : "false");
       return str;
     case OBJ_ARRAY: {
       keg* elem = obj->value.arr.element;
@@ -132,7 +166,7 @@ const char* obj_raw_string(object* obj, bool multiple) {
         strcat(str, obj_raw_string((object*)k->data[i], multiple));
         strcat(str, ": ");
         object* obj = v->data[i];
-        if (obj->kind == OBJ_STRING) {
+        if (kind_of(obj) == OBJ_STRING) {
           strcat(str, "\"");
           strcat(str, obj->value.str);
           strcat(str, "\"");
@@ -153,26 +187,28 @@ const char* obj_raw_string(object* obj, bool multiple) {
   }
 }
 
-object* lp = NULL;
-object* rp = NULL;
+/* Operands of binary_op, which the optimizer also calls while compiling
+ * modules on other threads. */
+static __thread object* lp = NULL;
+static __thread object* rp = NULL;
 
 void eval_obj_num(double* lv, double* rv, int m) {
   switch (m) {
     case 1:
-      *lv = (double)lp->value.num;
-      *rv = (double)rp->value.num;
+      *lv = (double)num_of(lp);
+      *rv = (double)num_of(rp);
       break;
     case 2:
-      *lv = lp->value.num;
-      *rv = rp->value.f;
+      *lv = num_of(lp);
+      *rv = float_of(rp);
       break;
     case 3:
-      *lv = lp->value.f;
-      *rv = rp->value.num;
+      *lv = float_of(lp);
+      *rv = num_of(rp);
       break;
     case 4:
-      *lv = lp->value.f;
-      *rv = rp->value.f;
+      *lv = float_of(lp);
+      *rv = float_of(rp);
       break;
   }
 }
@@ -181,20 +217,23 @@ object* op_basic(uint8_t op, int m) {
   double lv, rv, ev;
   eval_obj_num(&lv, &rv, m);
   bool integer = m == 1;
+  bool b;
 
-  object* obj = malloc(sizeof(object));
-
-#define STRING_EQ(op)   \
-  obj->kind = OBJ_BOOL; \
-  obj->value.b = strcmp(lp->value.str, rp->value.str) op 0;
+#define STRING_EQ(op) b = strcmp(lp->value.str, rp->value.str) op 0;
 
   switch (op) {
     case TO_ADD:
       if (m == 5) {
+        /* The bytes are kept right after the object and freed with it. */
+        size_t la = strlen(lp->value.str);
+        size_t lb = strlen(rp->value.str);
+        object* obj = gc_alloc(sizeof(object) + la + lb + 1);
+        char* cp = (char*)(obj + 1);
+        memcpy(cp, lp->value.str, la);
+        memcpy(cp + la, rp->value.str, lb + 1);
         obj->kind = OBJ_STRING;
-        char* cp = malloc(sizeof(char) * STRING_CAP_MAX);
-        sprintf(cp, "%s%s", lp->value.str, rp->value.str);
         obj->value.str = cp;
+        return obj;
       } else {
         ev = lv + rv;
       }
@@ -212,84 +251,74 @@ object* op_basic(uint8_t op, int m) {
       ev = (int)lv % (int)rv;
       break;
     case TO_GR:
-      obj->value.b = lv > rv;
+      b = lv > rv;
       break;
     case TO_GR_EQ:
-      obj->value.b = lv >= rv;
+      b = lv >= rv;
       break;
     case TO_LE:
-      obj->value.b = lv < rv;
+      b = lv < rv;
       break;
     case TO_LE_EQ:
-      obj->value.b = lv <= rv;
+      b = lv <= rv;
       break;
     case TO_EQ_EQ:
       if (m == 5) {
         STRING_EQ(==);
       } else {
-        obj->value.b = lv == rv;
+        b = lv == rv;
       }
       break;
     case TO_NOT_EQ:
       if (m == 5) {
         STRING_EQ(!=);
       } else {
-        obj->value.b = lv != rv;
+        b = lv != rv;
       }
       break;
   }
+#undef STRING_EQ
   if (op == TO_ADD || op == TO_SUB || op == TO_MUL || op == TO_DIV ||
       op == TO_SUR) {
     if (integer || op == TO_SUR) {
-      obj->kind = OBJ_INT;
-      obj->value.num = (int)ev;
-    } else if (m == 5 && op == TO_ADD) {
-      obj->kind = OBJ_STRING;
-    } else {
-      obj->kind = OBJ_FLOAT;
-      obj->value.f = ev;
+      return new_num((int)ev);
     }
+    return new_float(ev);
   }
-  if (op == TO_GR || op == TO_GR_EQ || op == TO_LE || op == TO_LE_EQ ||
-      op == TO_EQ_EQ || op == TO_NOT_EQ) {
-    obj->kind = OBJ_BOOL;
-  }
-#undef STRING_EQ
-  return obj;
+  return new_bool(b);
 }
 
 object* op_logic(uint8_t op, int m) {
-  object* obj = malloc(sizeof(object));
-  obj->kind = OBJ_BOOL;
-#define SIMPLE_LOGIC(op)                       \
-  if (m == 1) {                                \
-    obj->value.b = lp->value.c op rp->value.c; \
-  }                                            \
-  if (m == 3) {                                \
-    obj->value.b = lp->value.b op rp->value.b; \
+  bool b = false;
+#define SIMPLE_LOGIC(op)            \
+  if (m == 1) {                     \
+    b = char_of(lp) op char_of(rp); \
+  }                                 \
+  if (m == 3) {                     \
+    b = bool_of(lp) op bool_of(rp); \
   }
   switch (op) {
     case TO_EQ_EQ:
       SIMPLE_LOGIC(==);
       if (m == 3)
-        obj->value.b = true;
+        b = true;
       break;
     case TO_NOT_EQ:
       SIMPLE_LOGIC(!=);
       if (m == 2)
-        obj->value.b = false;
+        b = false;
       break;
     case TO_AND:
       if (m == 3)
-        obj->value.b = lp->value.b && rp->value.b;
+        b = bool_of(lp) && bool_of(rp);
       break;
     case TO_OR:
       if (m == 3)
-        obj->value.b = lp->value.b || rp->value.b;
+        b = bool_of(lp) || bool_of(rp);
       break;
   }
 #undef SIMPLE_LOGIC
-  return obj;
+  return new_bool(b);
 }
 
 eval_op_rule op_basic_rules[] = {{OBJ_INT, OBJ_INT, 1},
@@ -303,19 +332,15 @@ eval_op_rule op_logic_rules[] = {{OBJ_CHAR, OBJ_CHAR, 1},
                                  {OBJ_BOOL, OBJ_BOOL, 3}};
 
 object* op_default(uint8_t op) {
-  object* obj = malloc(sizeof(object));
   switch (op) {
     case TO_ADD:
     case TO_SUB:
     case TO_MUL:
     case TO_DIV:
     case TO_SUR:
-      obj->kind = OBJ_NIL;
-      return obj;
+      return new_nil();
     default:
-      obj->kind = OBJ_BOOL;
-      obj->value.b = false;
-      return obj;
+      return new_bool(false);
   }
 }
 
@@ -323,7 +348,7 @@ object* binary_op(uint8_t op, object* a, object* b) {
   int l = 5;
   for (int i = 0, sec = false; i < l; i++) {
     eval_op_rule rule = sec ? op_logic_rules[i] : op_basic_rules[i];
-    if (a->kind == rule.l && b->kind == rule.r) {
+    if (kind_of(a) == rule.l && kind_of(b) == rule.r) {
       lp = a;
       rp = b;
       return sec ? op_logic(op, rule.m) : op_basic(op, rule.m);
@@ -338,15 +363,15 @@ object* binary_op(uint8_t op, object* a, object* b) {
 }
 
 bool type_checker(type* tp, object* obj) {
-  if (obj->kind == OBJ_NIL) {
+  if (kind_of(obj) == OBJ_NIL) {
     return true;
   }
   switch (tp->kind) {
     case T_ARRAY:
     case T_TUPLE:
-      if (tp->kind == T_ARRAY && obj->kind != OBJ_ARRAY)
+      if (tp->kind == T_ARRAY && kind_of(obj) != OBJ_ARRAY)
         return false;
-      if (tp->kind == T_TUPLE && obj->kind != OBJ_TUPLE)
+      if (tp->kind == T_TUPLE && kind_of(obj) != OBJ_TUPLE)
         return false;
       keg* elem;
       if (tp->kind == T_ARRAY)
@@ -363,7 +388,7 @@ bool type_checker(type* tp, object* obj) {
       }
       break;
     case T_MAP:
-      if (obj->kind != OBJ_MAP)
+      if (kind_of(obj) != OBJ_MAP)
         return false;
       keg* k = obj->value.map.k;
       keg* v = obj->value.map.v;
@@ -379,7 +404,7 @@ bool type_checker(type* tp, object* obj) {
       }
       break;
     case T_FUNCTION:
-      if (obj->kind != OBJ_FUNCTION)
+      if (kind_of(obj) != OBJ_FUNCTION)
         return false;
       if (tp->inner.fn.arg->item != obj->value.fn.k->item)
         return false;
@@ -404,21 +429,21 @@ bool type_checker(type* tp, object* obj) {
       }
       break;
     default: {
-      if ((tp->kind == T_INT && obj->kind != OBJ_INT) ||
-          (tp->kind == T_FLOAT && obj->kind != OBJ_FLOAT) ||
-          (tp->kind == T_STRING && obj->kind != OBJ_STRING) ||
-          (tp->kind == T_CHAR && obj->kind != OBJ_CHAR) ||
-          (tp->kind == T_BOOL && obj->kind != OBJ_BOOL)) {
+      if ((tp->kind == T_INT && kind_of(obj) != OBJ_INT) ||
+          (tp->kind == T_FLOAT && kind_of(obj) != OBJ_FLOAT) ||
+          (tp->kind == T_STRING && kind_of(obj) != OBJ_STRING) ||
+          (tp->kind == T_CHAR && kind_of(obj) != OBJ_CHAR) ||
+          (tp->kind == T_BOOL && kind_of(obj) != OBJ_BOOL)) {
         return false;
       } else {
         if (tp->kind == T_USER) {
           const char* name = tp->inner.name;
 
-          if ((obj->kind == OBJ_FUNCTION &&
+          if ((kind_of(obj) == OBJ_FUNCTION &&
                strcmp(name, obj->value.fn.name) != 0) ||
-              (obj->kind == OBJ_ENUMERATE &&
+              (kind_of(obj) == OBJ_ENUMERATE &&
                strcmp(name, obj->value.en.name) != 0) ||
-              (obj->kind == OBJ_INTERFACE &&
+              (kind_of(obj) == OBJ_INTERFACE &&
                strcmp(name, obj->value.in.name) != 0)) {
             return false;
           }
@@ -430,26 +455,26 @@ bool type_checker(type* tp, object* obj) {
 }
 
 bool obj_eq(object* a, object* b) {
-  switch (a->kind) {
+  switch (kind_of(a)) {
     case OBJ_INT:
-      if (b->kind == OBJ_INT)
-        return a->value.num == b->value.num;
+      if (kind_of(b) == OBJ_INT)
+        return num_of(a) == num_of(b);
       break;
     case OBJ_FLOAT:
-      if (b->kind == OBJ_FLOAT)
-        return a->value.f == b->value.f;
+      if (kind_of(b) == OBJ_FLOAT)
+        return float_of(a) == float_of(b);
       break;
     case OBJ_CHAR:
-      if (b->kind == OBJ_CHAR)
-        return a->value.c == b->value.c;
+      if (kind_of(b) == OBJ_CHAR)
+        return char_of(a) == char_of(b);
       break;
     case OBJ_STRING:
-      if (b->kind == OBJ_STRING)
+      if (kind_of(b) == OBJ_STRING)
         return strcmp(a->value.str, b->value.str) == 0;
       break;
     case OBJ_BOOL:
-      if (b->kind == OBJ_BOOL)
-        return a->value.b ? b->value.b == true : b->value.b == false;
+      if (kind_of(b) == OBJ_BOOL)
+        return bool_of(a) ? bool_of(b) == true : bool_of(b) == false;
       break;
     default:
       return false;
@@ -457,18 +482,18 @@ bool obj_eq(object* a, object* b) {
 }
 
 bool obj_kind_eq(object* a, object* b) {
-  if ((a->kind == OBJ_INT && b->kind != OBJ_INT) ||
-      (a->kind == OBJ_FLOAT && b->kind != OBJ_FLOAT) ||
-      (a->kind == OBJ_STRING && b->kind != OBJ_STRING) ||
-      (a->kind == OBJ_CHAR && b->kind != OBJ_CHAR) ||
-      (a->kind == OBJ_BOOL && b->kind != OBJ_BOOL)) {
+  if ((kind_of(a) == OBJ_INT && kind_of(b) != OBJ_INT) ||
+      (kind_of(a) == OBJ_FLOAT && kind_of(b) != OBJ_FLOAT) ||
+      (kind_of(a) == OBJ_STRING && kind_of(b) != OBJ_STRING) ||
+      (kind_of(a) == OBJ_CHAR && kind_of(b) != OBJ_CHAR) ||
+      (kind_of(a) == OBJ_BOOL && kind_of(b) != OBJ_BOOL)) {
     return false;
   }
   return true;
 }
 
 const char* obj_type_string(object* obj) {
-  switch (obj->kind) {
+  switch (kind_of(obj)) {
     case OBJ_INT:
       return "int";
     case OBJ_FLOAT:
@@ -501,7 +526,7 @@ const char* obj_type_string(object* obj) {
 }
 
 int obj_len(object* obj) {
-  switch (obj->kind) {
+  switch (kind_of(obj)) {
     case OBJ_STRING:
       return strlen(obj->value.str);
     case OBJ_ARRAY:
@@ -515,43 +540,74 @@ int obj_len(object* obj) {
   }
 }
 
+#ifdef OBJ_IMMEDIATE
+static object* misc(obj_kind kind, uint8_t payload) {
+  int tag = kind == OBJ_NIL ? 0 : kind == OBJ_BOOL ? 1 : 2;
+  return (object*)(uintptr_t)(TAG_MISC | tag << 2 | payload << 4);
+}
+#endif
+
 object* new_num(int num) {
-  object* obj = malloc(sizeof(object));
+#ifdef OBJ_IMMEDIATE
+  return (object*)(uintptr_t)(TAG_NUMBER | (uint32_t)num);
+#else
+  object* obj = small_int(num);
+  if (obj != NULL) {
+    return obj;
+  }
+  obj = gc_alloc(sizeof(object));
   obj->kind = OBJ_INT;
   obj->value.num = num;
   return obj;
+#endif
 }
 
+/* NaNs with the top payload bits set would take the bits of ints once
+ * offset, they become the default one. */
 object* new_float(double fl) {
-  object* obj = malloc(sizeof(object));
+#ifdef OBJ_IMMEDIATE
+  uint64_t v;
+  memcpy(&v, &fl, sizeof(double));
+  if (v >= 0xfffc000000000000u) {
+    v = 0xfff8000000000000u;
+  }
+  return (object*)(uintptr_t)(v + FLOAT_OFFSET);
+#else
+  object* obj = gc_alloc(sizeof(object));
   obj->kind = OBJ_FLOAT;
   obj->value.f = fl;
   return obj;
+#endif
 }
 
 object* new_string(char* str) {
-  object* obj = malloc(sizeof(object));
+  object* obj = gc_alloc(sizeof(object));
   obj->kind = OBJ_STRING;
   obj->value.str = str;
   return obj;
 }
 
 object* new_char(char c) {
-  object* obj = malloc(sizeof(object));
+#ifdef OBJ_IMMEDIATE
+  return misc(OBJ_CHAR, c);
+#else
+  object* obj = gc_alloc(sizeof(object));
   obj->kind = OBJ_CHAR;
   obj->value.c = c;
   return obj;
+#endif
 }
 
 object* new_bool(bool b) {
-  object* obj = malloc(sizeof(object));
-  obj->kind = OBJ_BOOL;
-  obj->value.b = b;
-  return obj;
+#ifdef OBJ_IMMEDIATE
+  return misc(OBJ_BOOL, b);
+#else
+  return &bools[b];
+#endif
 }
 
 object* new_array(type_kind kind) {
-  object* obj = malloc(sizeof(object));
+  object* obj = gc_alloc(sizeof(object));
   obj->kind = OBJ_ARRAY;
   obj->value.arr.T = new_type(kind);
   obj->value.arr.element = new_keg();
@@ -559,8 +615,69 @@ object* new_array(type_kind kind) {
 }
 
 object* new_userdata(void* ptr) {
-  object* obj = malloc(sizeof(object));
+  object* obj = gc_alloc(sizeof(object));
   obj->kind = OBJ_CUSER;
   obj->value.cu.ptr = ptr;
   return obj;
-}
\ No newline at end of file
+}
+
+object* new_nil() {
+#ifdef OBJ_IMMEDIATE
+  return misc(OBJ_NIL, 0);
+#else
+  return &nil;
+#endif
+}
+
+object* box(object* obj) {
+  if (!is_immediate(obj)) {
+    return obj;
+  }
+  switch (kind_of(obj)) {
+    case OBJ_INT: {
+      object* p = small_int(num_of(obj));
+      if (p != NULL) {
+        return p;
+      }
+      break;
+    }
+    case OBJ_BOOL:
+      return &bools[bool_of(obj)];
+    case OBJ_NIL:
+      return &nil;
+  }
+  object* new = gc_alloc(sizeof(object));
+  new->kind = kind_of(obj);
+  switch (new->kind) {
+    case OBJ_INT:
+      new->value.num = num_of(obj);
+      break;
+    case OBJ_FLOAT:
+      new->value.f = float_of(obj);
+      break;
+    case OBJ_CHAR:
+      new->value.c = char_of(obj);
+      break;
+  }
+  return new;
+}
+
+object* unbox(object* obj) {
+  if (is_immediate(obj)) {
+    return obj;
+  }
+  switch (obj->kind) {
+    case OBJ_INT:
+      return new_num(obj->value.num);
+    case OBJ_FLOAT:
+      return new_float(obj->value.f);
+    case OBJ_CHAR:
+      return new_char(obj->value.c);
+    case OBJ_BOOL:
+      return new_bool(obj->value.b);
+    case OBJ_NIL:
+      return new_nil();
+    default:
+      return obj;
+  }
+}
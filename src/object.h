@@ -18,6 +18,15 @@
 #define DEBUG_OBJ_STR_CAP 64
 #define STRING_CAP_MAX 1024
 
+/* Ints in this range, true, false and nil are shared instances wherever
+ * they are not immediate, and when they are boxed. */
+#ifndef SMALL_INT_MIN
+#define SMALL_INT_MIN -128
+#endif
+#ifndef SMALL_INT_MAX
+#define SMALL_INT_MAX 1023
+#endif
+
 typedef enum {
   OBJ_INT,
   OBJ_FLOAT,
@@ -47,6 +56,7 @@ typedef enum {
 
 typedef struct {
   uint8_t kind;
+  uint32_t mark; /* last collection that found the object reachable */
   union {
     int num;
     double f;
@@ -122,6 +132,77 @@ typedef struct {
   } value;
 } object;
 
+/* Where pointers have 64 bits ints, floats, chars, bools and nil are
+ * immediate: the object pointer carries the value itself and must not be
+ * dereferenced, so none of them is allocated. Floats are kept NaN-boxed,
+ * their bits offset by 2^49 so no pointer is one of them, ints take the
+ * top of that range and the others are tagged below 4096, where no object
+ * lives. Heap objects of these kinds stay valid, constants of code objects
+ * are boxed, so any value is read through kind_of and the accessors. */
+#if UINTPTR_MAX == 0xffffffffffffffffu
+#define OBJ_IMMEDIATE
+#endif
+
+#define TAG_NUMBER 0xfffe000000000000u
+#define FLOAT_OFFSET 0x0002000000000000u
+#define TAG_MISC 2
+
+static inline bool is_immediate(object* obj) {
+#ifdef OBJ_IMMEDIATE
+  uintptr_t v = (uintptr_t)obj;
+  return (v & TAG_NUMBER) != 0 || (v & 3) == TAG_MISC;
+#else
+  return false;
+#endif
+}
+
+static inline uint8_t kind_of(object* obj) {
+#ifdef OBJ_IMMEDIATE
+  static const uint8_t misc[] = {OBJ_NIL, OBJ_BOOL, OBJ_CHAR};
+  uintptr_t v = (uintptr_t)obj;
+  if ((v & TAG_NUMBER) != 0) {
+    return (v & TAG_NUMBER) == TAG_NUMBER ? OBJ_INT : OBJ_FLOAT;
+  }
+  if ((v & 3) == TAG_MISC) {
+    return misc[v >> 2 & 3];
+  }
+#endif
+  return obj->kind;
+}
+
+/* The payload of an immediate, laid out like the union of an object so an
+ * accessor used on a value of another kind reads what it would have read
+ * there. */
+static inline uint64_t bits_of(object* obj) {
+  uint64_t v = (uintptr_t)obj;
+  if ((v & TAG_NUMBER) == TAG_NUMBER) {
+    return (uint32_t)v;
+  }
+  return (v & TAG_NUMBER) != 0 ? v - FLOAT_OFFSET : v >> 4;
+}
+
+static inline int num_of(object* obj) {
+  return is_immediate(obj) ? (int32_t)bits_of(obj) : obj->value.num;
+}
+
+static inline double float_of(object* obj) {
+  if (!is_immediate(obj)) {
+    return obj->value.f;
+  }
+  uint64_t v = bits_of(obj);
+  double f;
+  memcpy(&f, &v, sizeof(double));
+  return f;
+}
+
+static inline char char_of(object* obj) {
+  return is_immediate(obj) ? (char)bits_of(obj) : obj->value.c;
+}
+
+static inline bool bool_of(object* obj) {
+  return is_immediate(obj) ? (uint8_t)bits_of(obj) != 0 : obj->value.b;
+}
+
 typedef struct {
   char* name;
   keg* arg;
@@ -162,5 +243,17 @@ object* new_char(char);
 object* new_bool(bool);
 object* new_array(type_kind);
 object* new_userdata(void*);
+object* new_nil();
+
+/* Whether the object is one of the shared instances, which must never be
+ * changed or freed. */
+bool immortal(object*);
+
+/* A heap copy of an immediate, for constants and for C functions which read
+ * the fields of their arguments. Other objects are returned as they are. */
+object* box(object*);
+
+/* The immediate of a heap int, float, char, bool or nil. */
+object* unbox(object*);
 
 #endif
\ No newline at end of file
@@ -6,6 +6,8 @@
 #ifndef FT_OPCODE_H
 #define FT_OPCODE_H
 
+#include <stdint.h>
+
 typedef enum {
   CONST_OF,
   LOAD_OF,
@@ -54,19 +56,94 @@ typedef enum {
   F_JUMP_TO,
   TO_RET,
   RET_OF,
+  /* Function locals, resolved to frame slots by the optimizer. */
+  LOAD_LOCAL,
+  STORE_LOCAL,
+  ASSIGN_LOCAL,
+  /* Superinstructions, only produced by the optimizer. Variable operands
+   * of the LOAD_OF forms name a local slot when negative (-1 is slot 0)
+   * and a name otherwise. */
+  LOAD_CONST, /* LOAD_OF CONST_OF */
+  LOAD_LOAD,  /* LOAD_OF LOAD_OF */
+  LOAD_CALL,  /* LOAD_OF CALL_FUNC */
+  ADD_TO,     /* LOAD_OF x, CONST_OF, TO_ADD, ASSIGN_TO x */
+  CMP_JUMP,   /* TO_GR .. TO_NOT_EQ followed by F_JUMP_TO */
+  /* Three-address instructions of the register mode. */
+  REG_BINARY, /* operator, destination, left, right */
+  REG_JUMP,   /* comparison, left, right, offset taken when false */
+  /* Stores the optimizer has proven to always pass their type check. */
+  U_STORE_NAME,
+  U_STORE_LOCAL,
+  U_ASSIGN_LOCAL,
+  /* Type check of an argument or the result of an inlined call. */
+  CHECK_TYPE,
+  /* Discards the values an expression statement left above the depth the
+   * stack had before it. */
+  DROP_TO,
 } op_code;
 
+/* Register operands keep their kind in the two low bits and an index into
+ * the frame registers (local slots, then temporaries), the constant pool
+ * or the names above them. A destination of kind R_STACK is pushed. */
+enum reg_kind { R_REG, R_CONST, R_NAME, R_STACK };
+
+#define R_OPERAND(kind, i) (int16_t)((i) << 2 | (kind))
+#define R_KIND(v) ((v)&3)
+#define R_INDEX(v) ((v) >> 2)
+#define R_INDEX_MAX (INT16_MAX >> 2)
+
 static const char* code_string[] = {
-    "CONST_OF",  "LOAD_OF",   "ENUMERATE",  "CLASS",      "FUNCTION",
-    "INTERFACE", "ASSIGN_TO", "STORE_NAME", "TO_INDEX",   "TO_REPLACE",
-    "RANGE_OF",  "RANGE_GO",  "GET_OF",     "GET_IN_OF",  "SET_OF",
-    "CALL_FUNC", "SET_EB",    "RECV_EB",    "SET_NAME",   "REF_MODULE",
-    "REF_SET",   "NEW_OBJ",   "USE_MOD",    "USE_IN_MOD", "BUILD_ARR",
-    "BUILD_TUP", "BUILD_MAP", "TO_ADD",     "TO_SUB",     "TO_MUL",
-    "TO_DIV",    "TO_SUR",    "TO_GR",      "TO_LE",      "TO_GR_EQ",
-    "TO_LE_EQ",  "TO_EQ_EQ",  "TO_NOT_EQ",  "TO_AND",     "TO_OR",
-    "TO_BANG",   "TO_NOT",    "JUMP_TO",    "T_JUMP_TO",  "F_JUMP_TO",
-    "TO_RET",    "RET_OF",
+    "CONST_OF",    "LOAD_OF",      "ENUMERATE",     "CLASS",
+    "FUNCTION",    "INTERFACE",    "ASSIGN_TO",     "STORE_NAME",
+    "TO_INDEX",    "TO_REPLACE",   "RANGE_OF",      "RANGE_GO",
+    "GET_OF",      "GET_IN_OF",    "SET_OF",        "CALL_FUNC",
+    "SET_EB",      "RECV_EB",      "SET_NAME",      "REF_MODULE",
+    "REF_SET",     "NEW_OBJ",      "USE_MOD",       "USE_IN_MOD",
+    "BUILD_ARR",   "BUILD_TUP",    "BUILD_MAP",     "TO_ADD",
+    "TO_SUB",      "TO_MUL",       "TO_DIV",        "TO_SUR",
+    "TO_GR",       "TO_LE",        "TO_GR_EQ",      "TO_LE_EQ",
+    "TO_EQ_EQ",    "TO_NOT_EQ",    "TO_AND",        "TO_OR",
+    "TO_BANG",     "TO_NOT",       "JUMP_TO",       "T_JUMP_TO",
+    "F_JUMP_TO",   "TO_RET",       "RET_OF",        "LOAD_LOCAL",
+    "STORE_LOCAL", "ASSIGN_LOCAL", "LOAD_CONST",    "LOAD_LOAD",
+    "LOAD_CALL",   "ADD_TO",       "CMP_JUMP",      "REG_BINARY",
+    "REG_JUMP",    "U_STORE_NAME", "U_STORE_LOCAL", "U_ASSIGN_LOCAL",
+    "CHECK_TYPE",  "DROP_TO",
 };
 
+/* Number of operands that follow each opcode in the stream. They are
+ * int16 but for the jump target, see jump_operand. */
+static const uint8_t code_operand[] = {
+    1, 1, 1, 1, 1, 1, 1, 2, 0, 0, /* CONST_OF .. TO_REPLACE */
+    3, 2, 2, 2, 1, 1, 1, 0, 1, 2, /* RANGE_OF .. REF_MODULE */
+    1, 1, 1, 1, 1, 1, 1, 0, 0, 0, /* REF_SET .. TO_MUL */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* TO_DIV .. TO_OR */
+    0, 0, 1, 1, 1, 0, 0, 1, 2, 1, /* TO_BANG .. ASSIGN_LOCAL */
+    2, 2, 2, 2, 2, 4, 4, 2, 2, 1, /* LOAD_CONST .. U_ASSIGN_LOCAL */
+    1, 1,                         /* CHECK_TYPE .. DROP_TO */
+};
+
+/* Index of the operand holding a jump target, -1 if there is none. The
+ * target is always the last operand and takes 32 bits. */
+static inline int jump_operand(uint8_t op) {
+  switch (op) {
+    case JUMP_TO:
+    case T_JUMP_TO:
+    case F_JUMP_TO:
+      return 0;
+    case RANGE_OF:
+      return 2;
+    case RANGE_GO:
+    case CMP_JUMP:
+      return 1;
+    case REG_JUMP:
+      return 3;
+    default:
+      return -1;
+  }
+}
+
+#define CODE_SIZE(op) \
+  (1 + 2 * code_operand[op] + (jump_operand(op) == -1 ? 0 : 2))
+
 #endif
\ No newline at end of file
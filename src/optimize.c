@@ -0,0 +1,1319 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#include <stdbool.h>
+#include <string.h>
+
+#include "object.h"
+#include "optimize.h"
+#include "pool.h"
+
+typedef struct {
+  uint8_t op;
+  int32_t arg[4]; /* int16 but for the jump target */
+  int line;
+  int pc;      /* byte offset in the unoptimized stream */
+  bool live;   /* false once the instruction has been removed */
+  bool target; /* a jump lands on this instruction */
+} instr;
+
+/* Index of the operand holding a constant pool index, -1 if there is none. */
+static int obj_arg(uint8_t op) {
+  switch (op) {
+    case CONST_OF:
+    case ENUMERATE:
+    case CLASS:
+    case FUNCTION:
+    case INTERFACE:
+    case SET_EB:
+      return 0;
+    case LOAD_CONST:
+    case ADD_TO:
+      return 1;
+    default:
+      return -1;
+  }
+}
+
+static int prev_live(instr* ins, int i) {
+  do {
+    i--;
+  } while (i >= 0 && !ins[i].live);
+  return i;
+}
+
+static int next_live(instr* ins, int n, int i) {
+  do {
+    i++;
+  } while (i < n && !ins[i].live);
+  return i;
+}
+
+/* First live instruction at or after the old offset pc, n for the end. */
+static int resolve(instr* ins, int n, int pc) {
+  int lo = 0, hi = n;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (ins[mid].pc < pc) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < n && !ins[lo].live ? next_live(ins, n, lo) : lo;
+}
+
+/* Jumps into a removed instruction fall through to the next live one. */
+static void kill(instr* ins, int n, int i) {
+  ins[i].live = false;
+  if (ins[i].target) {
+    int next = next_live(ins, n, i);
+    if (next < n) {
+      ins[next].target = true;
+    }
+  }
+}
+
+static void mark_targets(instr* ins, int n) {
+  for (int i = 0; i < n; i++) {
+    ins[i].target = false;
+  }
+  for (int i = 0; i < n; i++) {
+    int a = jump_operand(ins[i].op);
+    if (!ins[i].live || a == -1 || ins[i].arg[a] < 0) {
+      continue;
+    }
+    int t = resolve(ins, n, ins[i].arg[a]);
+    if (t < n) {
+      ins[t].target = true;
+    }
+  }
+}
+
+static bool binary(uint8_t op) {
+  return op >= TO_ADD && op <= TO_OR;
+}
+
+static bool number(object* obj) {
+  return obj->kind == OBJ_INT || obj->kind == OBJ_FLOAT;
+}
+
+/* Only the operand pairs binary_op defines a result for are folded, anything
+ * that would raise or trap at run time is left to the virtual machine. */
+static object* fold_binary(uint8_t op, object* a, object* b) {
+  if (number(a) && number(b)) {
+    double rv = b->kind == OBJ_INT ? b->value.num : b->value.f;
+    if (op == TO_AND || op == TO_OR) {
+      return NULL;
+    }
+    if ((op == TO_DIV && rv == 0) || (op == TO_SUR && (int)rv == 0)) {
+      return NULL;
+    }
+    return binary_op(op, a, b);
+  }
+  if (a->kind != b->kind) {
+    return NULL;
+  }
+  switch (a->kind) {
+    case OBJ_STRING:
+      if (strlen(a->value.str) + strlen(b->value.str) >= STRING_CAP_MAX) {
+        return NULL;
+      }
+      if (op == TO_ADD || op == TO_EQ_EQ || op == TO_NOT_EQ) {
+        return binary_op(op, a, b);
+      }
+      return NULL;
+    case OBJ_BOOL:
+      if (op == TO_AND || op == TO_OR) {
+        return binary_op(op, a, b);
+      }
+      /* fall through */
+    case OBJ_CHAR:
+      if (op == TO_EQ_EQ || op == TO_NOT_EQ) {
+        return binary_op(op, a, b);
+      }
+  }
+  return NULL;
+}
+
+static object* fold_unary(uint8_t op, object* obj) {
+  if (op == TO_NOT) {
+    if (obj->kind == OBJ_INT) {
+      return new_num(-obj->value.num);
+    }
+    if (obj->kind == OBJ_FLOAT) {
+      return new_float(-obj->value.f);
+    }
+    return NULL;
+  }
+  switch (obj->kind) {
+    case OBJ_INT:
+      return new_bool(!obj->value.num);
+    case OBJ_FLOAT:
+      return new_bool(!obj->value.f);
+    case OBJ_CHAR:
+      return new_bool(!obj->value.c);
+    case OBJ_STRING:
+      return new_bool(!strlen(obj->value.str));
+    case OBJ_BOOL:
+      return new_bool(!obj->value.b);
+    default:
+      return new_bool(false);
+  }
+}
+
+static int16_t add_const(code_object* code, object* obj) {
+  return pool_add_obj(&code->objects, obj);
+}
+
+/* Collapses constant operands into a single CONST_OF and resolves branches
+ * on constant conditions. A jump must not land between the instructions
+ * being merged, so only the first of them may be a jump target. */
+static bool fold(code_object* code, instr* ins, int n) {
+  bool changed = false;
+  for (int i = 0; i < n; i++) {
+    uint8_t op = ins[i].op;
+    if (!ins[i].live || ins[i].target) {
+      continue;
+    }
+    int a = prev_live(ins, i);
+    if (a == -1 || ins[a].op != CONST_OF) {
+      continue;
+    }
+    object* x = code->objects->data[ins[a].arg[0]];
+
+    if (binary(op)) {
+      int b = prev_live(ins, a);
+      if (ins[a].target || b == -1 || ins[b].op != CONST_OF) {
+        continue;
+      }
+      object* obj = fold_binary(op, code->objects->data[ins[b].arg[0]], x);
+      if (obj == NULL) {
+        continue;
+      }
+      ins[b].arg[0] = add_const(code, obj);
+      kill(ins, n, a);
+      kill(ins, n, i);
+    } else if (op == TO_NOT || op == TO_BANG) {
+      object* obj = fold_unary(op, x);
+      if (obj == NULL) {
+        continue;
+      }
+      ins[a].arg[0] = add_const(code, obj);
+      kill(ins, n, i);
+    } else if ((op == F_JUMP_TO || op == T_JUMP_TO) && x->kind == OBJ_BOOL) {
+      kill(ins, n, a);
+      if (x->value.b == (op == T_JUMP_TO)) {
+        ins[i].op = JUMP_TO;
+      } else {
+        kill(ins, n, i);
+      }
+    } else {
+      continue;
+    }
+    changed = true;
+  }
+  return changed;
+}
+
+/* Unconditional jumps to the very next instruction. */
+static bool drop_jumps(instr* ins, int n) {
+  bool changed = false;
+  for (int i = 0; i < n; i++) {
+    if (!ins[i].live || ins[i].op != JUMP_TO || ins[i].arg[0] < 0) {
+      continue;
+    }
+    if (resolve(ins, n, ins[i].arg[0]) == next_live(ins, n, i)) {
+      kill(ins, n, i);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+/* The instructions that can be reached from the entry without passing
+ * through the one at skip, which is not reached either. */
+static bool* reachable(instr* ins, int n, int skip) {
+  bool* seen = calloc(n + 1, sizeof(bool));
+  int* work = malloc(sizeof(int) * (2 * n + 1));
+  int top = 0;
+  work[top++] = resolve(ins, n, 0);
+
+  while (top > 0) {
+    int i = work[--top];
+    if (i >= n || seen[i] || i == skip) {
+      continue;
+    }
+    seen[i] = true;
+
+    uint8_t op = ins[i].op;
+    int a = jump_operand(op);
+    if (a != -1 && ins[i].arg[a] >= 0) {
+      work[top++] = resolve(ins, n, ins[i].arg[a]);
+    }
+    if (op != JUMP_TO && op != TO_RET && op != RET_OF) {
+      work[top++] = next_live(ins, n, i);
+    }
+  }
+  free(work);
+  return seen;
+}
+
+/* Removes every instruction that cannot be reached from the entry. */
+static bool drop_unreachable(instr* ins, int n) {
+  bool* seen = reachable(ins, n, -1);
+  bool changed = false;
+  for (int i = 0; i < n; i++) {
+    if (ins[i].live && !seen[i]) {
+      kill(ins, n, i);
+      changed = true;
+    }
+  }
+  free(seen);
+  return changed;
+}
+
+static char* obj_name(object* obj) {
+  switch (obj->kind) {
+    case OBJ_FUNCTION:
+      return obj->value.fn.name;
+    case OBJ_CLASS:
+      return obj->value.cl.name;
+    case OBJ_ENUMERATE:
+      return obj->value.en.name;
+    case OBJ_INTERFACE:
+      return obj->value.in.name;
+    case OBJ_EBLOCK:
+      return obj->value.eb.name;
+    default:
+      return NULL;
+  }
+}
+
+static int find_name(keg* g, char* name) {
+  for (int i = 0; g != NULL && name != NULL && i < g->item; i++) {
+    if (strcmp(g->data[i], name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* Gives the parameters and locals of a function numbered frame slots,
+ * parameters first. A name that is also bound into the frame table some
+ * other way (range variables, modules, definitions) keeps going through
+ * the table, and nothing is resolved when a parameter is one of them or
+ * the body pulls a whole module into its scope. Outside a function, params
+ * is NULL and only the names of inlined calls get slots, the others belong
+ * to the module or class. */
+static void resolve_locals(code_object* code, keg* params, instr* ins, int n) {
+  keg* names = NULL;
+  for (int i = 0; params != NULL && i < params->item; i++) {
+    names = append_keg(names, params->data[i]);
+  }
+  for (int i = 0; i < n; i++) {
+    if (!ins[i].live || ins[i].op != STORE_NAME) {
+      continue;
+    }
+    char* name = code->names->data[ins[i].arg[1]];
+    if (params == NULL && strchr(name, '.') == NULL) {
+      continue;
+    }
+    if (find_name(names, name) == -1) {
+      names = append_keg(names, name);
+    }
+  }
+  if (names == NULL) {
+    return;
+  }
+
+  bool whole = false;
+  bool* bound = calloc(names->item, sizeof(bool));
+  for (int i = 0; i < n; i++) {
+    if (!ins[i].live) {
+      continue;
+    }
+    int32_t* arg = ins[i].arg;
+    char* other[2] = {NULL, NULL};
+    switch (ins[i].op) {
+      case USE_IN_MOD:
+        whole = true;
+        break;
+      case RANGE_OF:
+        other[1] = code->names->data[arg[1]];
+        /* fall through */
+      case RANGE_GO:
+      case SET_NAME:
+      case GET_IN_OF:
+        other[0] = code->names->data[arg[0]];
+        break;
+      case FUNCTION:
+      case CLASS:
+      case ENUMERATE:
+      case INTERFACE:
+      case SET_EB:
+        other[0] = obj_name(code->objects->data[arg[0]]);
+        break;
+    }
+    for (int j = 0; j < 2; j++) {
+      int k = find_name(names, other[j]);
+      if (k != -1) {
+        bound[k] = true;
+      }
+    }
+  }
+  for (int i = 0; params != NULL && i < params->item; i++) {
+    whole |= bound[i];
+  }
+
+  int* slot = NULL;
+  if (!whole && code->names != NULL) {
+    slot = malloc(sizeof(int) * code->names->item);
+    for (int i = 0; i < names->item; i++) {
+      if (!bound[i]) {
+        code->locals = append_keg(code->locals, names->data[i]);
+      }
+    }
+    for (int i = 0; i < code->names->item; i++) {
+      slot[i] = find_name(code->locals, code->names->data[i]);
+    }
+  }
+  for (int i = 0; slot != NULL && i < n; i++) {
+    int32_t* arg = ins[i].arg;
+    if (!ins[i].live) {
+      continue;
+    }
+    if (ins[i].op == LOAD_OF && slot[arg[0]] != -1) {
+      ins[i].op = LOAD_LOCAL;
+      arg[0] = slot[arg[0]];
+    }
+    if (ins[i].op == ASSIGN_TO && slot[arg[0]] != -1) {
+      ins[i].op = ASSIGN_LOCAL;
+      arg[0] = slot[arg[0]];
+    }
+    if (ins[i].op == STORE_NAME && slot[arg[1]] != -1) {
+      ins[i].op = STORE_LOCAL;
+      arg[1] = slot[arg[1]];
+    }
+  }
+  free(slot);
+  free(bound);
+  free_keg(names);
+}
+
+/* Kind of a value that may also be nil, which passes every type check. */
+#define MAYBE_NIL 0x100
+#define KIND(k) ((k) & ~MAYBE_NIL)
+
+typedef struct {
+  code_object* code;
+  instr* ins;
+  int n;
+  int slots;
+  int* kind; /* object kind every slot holds when set, -1 if unknown */
+  bool* set; /* per instruction, the slots certainly stored before it */
+} typing;
+
+/* Object kind of the values a primitive type admits, -1 for the others. */
+static int value_kind(type* T) {
+  switch (T == NULL ? -1 : T->kind) {
+    case T_INT:
+      return OBJ_INT;
+    case T_FLOAT:
+      return OBJ_FLOAT;
+    case T_CHAR:
+      return OBJ_CHAR;
+    case T_STRING:
+      return OBJ_STRING;
+    case T_BOOL:
+      return OBJ_BOOL;
+    default:
+      return -1;
+  }
+}
+
+static bool numeric(int k) {
+  return KIND(k) == OBJ_INT || KIND(k) == OBJ_FLOAT;
+}
+
+/* Kind of the value the instruction at i leaves on the stack, -1 if it is
+ * unknown. start receives the first instruction of the whole expression or
+ * -1 when the operands could not be followed back. */
+static int expr_kind(typing* t, int i, int* start) {
+  *start = -1;
+  if (i < 0) {
+    return -1;
+  }
+  instr* in = &t->ins[i];
+  switch (in->op) {
+    case CONST_OF:
+      *start = i;
+      return ((object*)t->code->objects->data[in->arg[0]])->kind;
+    case LOAD_LOCAL: {
+      *start = i;
+      int s = in->arg[0];
+      return t->set[i * t->slots + s] ? t->kind[s] : -1;
+    }
+    case CHECK_TYPE: {
+      int k = -1;
+      if (!in->target) {
+        k = expr_kind(t, prev_live(t->ins, i), start);
+      }
+      int T = value_kind(t->code->types->data[in->arg[0]]);
+      if (k == OBJ_NIL || (k != -1 && KIND(k) == T)) {
+        return k;
+      }
+      return T == -1 ? -1 : T | MAYBE_NIL;
+    }
+    case TO_BANG:
+    case TO_NOT: {
+      int k = -1;
+      if (!in->target) {
+        k = expr_kind(t, prev_live(t->ins, i), start);
+      }
+      if (in->op == TO_BANG) {
+        return OBJ_BOOL;
+      }
+      return numeric(k) ? KIND(k) : -1;
+    }
+  }
+  if (!binary(in->op)) {
+    return -1;
+  }
+  int b = -1, a = -1, mid = -1;
+  if (!in->target) {
+    b = expr_kind(t, prev_live(t->ins, i), &mid);
+  }
+  if (mid != -1 && !t->ins[mid].target) {
+    a = expr_kind(t, prev_live(t->ins, mid), start);
+  }
+  if (in->op >= TO_GR && in->op <= TO_NOT_EQ) {
+    return OBJ_BOOL;
+  }
+  if (a == -1 || b == -1) {
+    return -1;
+  }
+  int nil = (a | b) & MAYBE_NIL;
+  switch (in->op) {
+    case TO_AND:
+    case TO_OR:
+      return KIND(a) == OBJ_BOOL && KIND(b) == OBJ_BOOL ? OBJ_BOOL : -1;
+    case TO_ADD:
+      if (KIND(a) == OBJ_STRING && KIND(b) == OBJ_STRING) {
+        return OBJ_STRING | nil;
+      }
+  }
+  if (!numeric(a) || !numeric(b)) {
+    return -1;
+  }
+  if (in->op == TO_SUR || (KIND(a) == OBJ_INT && KIND(b) == OBJ_INT)) {
+    return OBJ_INT | nil;
+  }
+  return OBJ_FLOAT | nil;
+}
+
+/* Kind of the value the instruction at i consumes from the stack. */
+static int operand_kind(typing* t, int i) {
+  int start;
+  return t->ins[i].target ? -1 : expr_kind(t, prev_live(t->ins, i), &start);
+}
+
+/* Fills t->set, the locals that are stored on every path to each
+ * instruction. A local read before that resolves through the names. */
+static void stored_slots(typing* t, keg* params) {
+  int n = t->n, m = t->slots;
+  bool* set = t->set;
+  bool* out = malloc(sizeof(bool) * (m + 1));
+  memset(set, true, sizeof(bool) * n * m);
+  int entry = resolve(t->ins, n, 0);
+  for (int s = 0; entry < n && s < m; s++) {
+    set[entry * m + s] = params != NULL && s < params->item;
+  }
+  bool changed;
+  do {
+    changed = false;
+    for (int i = 0; i < n; i++) {
+      instr* in = &t->ins[i];
+      if (!in->live) {
+        continue;
+      }
+      memcpy(out, &set[i * m], sizeof(bool) * m);
+      if (in->op == STORE_LOCAL) {
+        out[in->arg[1]] = true;
+      }
+      if (in->op == ASSIGN_LOCAL) {
+        out[in->arg[0]] = true;
+      }
+      int succ[2] = {n, n};
+      int a = jump_operand(in->op);
+      if (a != -1 && in->arg[a] >= 0) {
+        succ[0] = resolve(t->ins, n, in->arg[a]);
+      }
+      if (in->op != JUMP_TO && in->op != TO_RET && in->op != RET_OF) {
+        succ[1] = next_live(t->ins, n, i);
+      }
+      for (int j = 0; j < 2; j++) {
+        for (int s = 0; succ[j] < n && s < m; s++) {
+          if (set[succ[j] * m + s] && !out[s]) {
+            set[succ[j] * m + s] = false;
+            changed = true;
+          }
+        }
+      }
+    }
+  } while (changed);
+  free(out);
+}
+
+/* Kind every local holds once set, with MAYBE_NIL when it may be nil.
+ * Declarations check their type at run time, so a local keeps the kind
+ * all of them agree on. An assignment cannot change the kind of a local
+ * that is set and not nil, the check fails first; one to a nil or unset
+ * local has to be proven. Starts from the most precise kinds and weakens
+ * them until every store agrees. */
+static void slot_kinds(typing* t, object* fn) {
+  keg* v = fn == NULL ? NULL : fn->value.fn.v;
+  for (int s = 0; s < t->slots; s++) {
+    t->kind[s] = -2;
+    if (fn != NULL && s < fn->value.fn.k->item) {
+      int k = s < v->item ? value_kind(v->data[s]) : -1;
+      t->kind[s] = k == -1 ? -1 : k | MAYBE_NIL;
+    }
+  }
+  for (int i = 0; i < t->n; i++) {
+    instr* in = &t->ins[i];
+    if (in->live && in->op == STORE_LOCAL) {
+      int s = in->arg[1];
+      int k = value_kind(t->code->types->data[in->arg[0]]);
+      if (t->kind[s] == -2 || k == -1) {
+        t->kind[s] = k;
+      } else if (KIND(t->kind[s]) != k) {
+        t->kind[s] = -1;
+      }
+    }
+  }
+  for (int s = 0; s < t->slots; s++) {
+    t->kind[s] = t->kind[s] == -2 ? -1 : t->kind[s];
+  }
+  bool changed;
+  do {
+    changed = false;
+    for (int i = 0; i < t->n; i++) {
+      instr* in = &t->ins[i];
+      if (!in->live || (in->op != STORE_LOCAL && in->op != ASSIGN_LOCAL)) {
+        continue;
+      }
+      int s = in->op == STORE_LOCAL ? in->arg[1] : in->arg[0];
+      int had = t->kind[s];
+      if (had == -1) {
+        continue;
+      }
+      int k = operand_kind(t, i);
+      if (in->op == ASSIGN_LOCAL &&
+          (!t->set[i * t->slots + s] || (had & MAYBE_NIL)) &&
+          k != OBJ_NIL && (k == -1 || KIND(k) != KIND(had))) {
+        t->kind[s] = -1;
+      } else if (k == -1 || k == OBJ_NIL || (k & MAYBE_NIL)) {
+        if (in->op == STORE_LOCAL || !t->set[i * t->slots + s]) {
+          t->kind[s] |= MAYBE_NIL;
+        }
+      }
+      changed |= t->kind[s] != had;
+    }
+  } while (changed);
+}
+
+/* Turns stores of values whose kind is known at compile time into the
+ * unchecked variants, drops such checks of inlined calls and marks a
+ * function whose every return value is known to match its declared type.
+ * Only primitive types are proven, the rest (any, generics, classes,
+ * values from calls) keep their checks. */
+static void check_types(code_object* code, object* fn, instr* ins, int n) {
+  typing t = {code, ins, n, 0, NULL, NULL};
+  if (code->locals != NULL) {
+    t.slots = code->locals->item;
+  }
+  t.kind = malloc(sizeof(int) * (t.slots + 1));
+  t.set = malloc(sizeof(bool) * (n * t.slots + 1));
+  mark_targets(ins, n);
+  if (t.slots != 0) {
+    stored_slots(&t, fn == NULL ? NULL : fn->value.fn.k);
+    slot_kinds(&t, fn);
+  }
+
+  int ret = fn == NULL ? -1 : value_kind(fn->value.fn.ret);
+  code->typed = ret != -1;
+  for (int i = 0; i < n; i++) {
+    instr* in = &ins[i];
+    if (!in->live) {
+      continue;
+    }
+    switch (in->op) {
+      case STORE_NAME:
+      case STORE_LOCAL: {
+        int T = value_kind(code->types->data[in->arg[0]]);
+        int k = operand_kind(&t, i);
+        if (T != -1 && (k == OBJ_NIL || (k != -1 && KIND(k) == T))) {
+          in->op = in->op == STORE_NAME ? U_STORE_NAME : U_STORE_LOCAL;
+        }
+        break;
+      }
+      case CHECK_TYPE: {
+        int T = value_kind(code->types->data[in->arg[0]]);
+        int k = operand_kind(&t, i);
+        if (T != -1 && (k == OBJ_NIL || (k != -1 && KIND(k) == T))) {
+          kill(ins, n, i);
+        }
+        break;
+      }
+      case ASSIGN_LOCAL: {
+        int s = in->arg[0];
+        if (t.set[i * t.slots + s] && t.kind[s] != -1 &&
+            operand_kind(&t, i) == KIND(t.kind[s])) {
+          in->op = U_ASSIGN_LOCAL;
+        }
+        break;
+      }
+      case RET_OF: {
+        int k = operand_kind(&t, i);
+        if (k != OBJ_NIL && (k == -1 || KIND(k) != ret)) {
+          code->typed = false;
+        }
+        break;
+      }
+    }
+  }
+  free(t.kind);
+  free(t.set);
+}
+
+/* The instructions of code with their lines and offsets. */
+static instr* decode(code_object* code) {
+  int n = code->count;
+  instr* ins = malloc(sizeof(instr) * (n + 1));
+  int at = 0, run = 0, line = 0, cur = 0;
+  bool more = next_line(&code->lines, &at, &run, &line);
+
+  for (int i = 0, p = 0; i < n; i++) {
+    uint8_t op = code->codes[p];
+    ins[i].op = op;
+    for (int j = 0; j < code_operand[op]; j++) {
+      ins[i].arg[j] = j == jump_operand(op)
+                          ? READ_JUMP(code->codes, p + 1 + 2 * j)
+                          : READ_OFF(code->codes, p + 1 + 2 * j);
+    }
+    while (more && run <= p) {
+      cur = line;
+      more = next_line(&code->lines, &at, &run, &line);
+    }
+    ins[i].line = cur;
+    ins[i].pc = p;
+    ins[i].live = true;
+    p += CODE_SIZE(op);
+  }
+  return ins;
+}
+
+/* Largest body of a function, in instructions, inlined at its calls. */
+#define INLINE_BUDGET 16
+
+/* Stack effect of the instructions an inlined call and its arguments may
+ * be made of, false for any other instruction. */
+static bool effect(instr* in, int* d) {
+  switch (in->op) {
+    case CONST_OF:
+    case LOAD_OF:
+      *d = 1;
+      return true;
+    case TO_BANG:
+    case TO_NOT:
+      *d = 0;
+      return true;
+    case CALL_FUNC:
+      *d = -in->arg[0];
+      return true;
+    default:
+      *d = -1;
+      return binary(in->op);
+  }
+}
+
+/* Instructions of the body of fn up to its return when it can be inlined,
+ * -1 otherwise. That is a straight run of expressions over the parameters
+ * and its own locals, all of primitive types, ending in a return. */
+static int inline_size(object* fn) {
+  keg* k = fn->value.fn.k;
+  keg* v = fn->value.fn.v;
+  keg* gt = fn->value.fn.gt;
+  if (fn->value.fn.mutiple != NULL || (gt != NULL && gt->item != 0) ||
+      value_kind(fn->value.fn.ret) == -1 || k->item != v->item) {
+    return -1;
+  }
+  keg* names = new_keg();
+  for (int i = 0; i < k->item; i++) {
+    if (value_kind(v->data[i]) == -1) {
+      free_keg(names);
+      return -1;
+    }
+    names = append_keg(names, k->data[i]);
+  }
+
+  code_object* code = fn->value.fn.code;
+  instr* ins = decode(code);
+  int size = -1;
+  for (int i = 0, depth = 0, d; i < code->count && i < INLINE_BUDGET; i++) {
+    int32_t* arg = ins[i].arg;
+    char* name = NULL;
+    switch (ins[i].op) {
+      case CONST_OF: {
+        object* obj = code->objects->data[arg[0]];
+        if (obj->kind > OBJ_BOOL && obj->kind != OBJ_NIL) {
+          goto out;
+        }
+        break;
+      }
+      case LOAD_OF:
+      case ASSIGN_TO:
+        name = code->names->data[arg[0]];
+        break;
+      case STORE_NAME:
+        if (value_kind(code->types->data[arg[0]]) == -1) {
+          goto out;
+        }
+        if (find_name(names, code->names->data[arg[1]]) == -1) {
+          names = append_keg(names, code->names->data[arg[1]]);
+        }
+        break;
+      case RET_OF:
+        size = depth == 1 ? i + 1 : -1;
+        goto out;
+    }
+    if (ins[i].op == STORE_NAME || ins[i].op == ASSIGN_TO) {
+      d = -1;
+    } else if (!effect(&ins[i], &d) || ins[i].op == CALL_FUNC) {
+      goto out;
+    }
+    depth += d;
+    if (depth < 0 || (name != NULL && find_name(names, name) == -1)) {
+      goto out;
+    }
+  }
+out:
+  free(ins);
+  free_keg(names);
+  return size;
+}
+
+/* Whether an instruction other than the one at def may bind name in the
+ * frame of code. A module is bound to the last of the names pushed with
+ * SET_NAME before USE_MOD. */
+static bool rebound(code_object* code, instr* ins, int n, int def,
+                    char* name) {
+  for (int i = 0; i < n; i++) {
+    int32_t* arg = ins[i].arg;
+    char* other[2] = {NULL, NULL};
+    if (!ins[i].live || i == def) {
+      continue;
+    }
+    switch (ins[i].op) {
+      case USE_IN_MOD:
+        return true;
+      case RANGE_OF:
+        other[1] = code->names->data[arg[1]];
+        /* fall through */
+      case RANGE_GO:
+      case SET_NAME:
+      case ASSIGN_TO:
+        other[0] = code->names->data[arg[0]];
+        break;
+      case STORE_NAME:
+        other[0] = code->names->data[arg[1]];
+        break;
+      case FUNCTION:
+      case CLASS:
+      case ENUMERATE:
+      case INTERFACE:
+      case SET_EB:
+        other[0] = obj_name(code->objects->data[arg[0]]);
+        break;
+    }
+    for (int j = 0; j < 2; j++) {
+      if (other[j] != NULL && strcmp(other[j], name) == 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/* The call of the function loaded at i, -1 when its arguments are not
+ * simple expressions or a jump lands among them. */
+static int call_of(instr* ins, int n, int i) {
+  for (int j = i + 1, depth = 0, d; j < n; j++) {
+    if (ins[j].target || !effect(&ins[j], &d)) {
+      return -1;
+    }
+    if (ins[j].op == CALL_FUNC && ins[j].arg[0] >= depth) {
+      return ins[j].arg[0] == depth ? j : -1;
+    }
+    depth += d;
+  }
+  return -1;
+}
+
+/* Name in the caller of a parameter or local of the inlined fn. The dot
+ * keeps it apart from the names of the program. */
+static int16_t inline_name(code_object* code, object* fn, char* name) {
+  char* str = malloc(strlen(fn->value.fn.name) + strlen(name) + 2);
+  sprintf(str, "%s.%s", fn->value.fn.name, name);
+  int16_t i = pool_add_name(&code->names, str);
+  if (code->names->data[i] != str) {
+    free(str);
+  }
+  return i;
+}
+
+/* Types of functions are not pooled, a copy is handed to the pool. */
+static int16_t inline_type(code_object* code, type* T) {
+  type* t = malloc(sizeof(type));
+  memcpy(t, T, sizeof(type));
+  return pool_add_type(&code->types, t);
+}
+
+/* Writes the body of fn in place of the call to out at m, the new end. */
+static int expand(code_object* code, object* fn, instr* call, instr* out,
+                  int m) {
+  keg* k = fn->value.fn.k;
+  keg* v = fn->value.fn.v;
+  for (int i = k->item - 1; i >= 0; i--) {
+    int16_t T = inline_type(code, v->data[i]);
+    out[m] = *call;
+    out[m].op = CHECK_TYPE;
+    out[m++].arg[0] = T;
+    out[m] = *call;
+    out[m].op = STORE_NAME;
+    out[m].arg[0] = T;
+    out[m++].arg[1] = inline_name(code, fn, k->data[i]);
+  }
+
+  code_object* body = fn->value.fn.code;
+  instr* ins = decode(body);
+  for (int i = 0, ret = false; !ret; i++) {
+    instr* in = &out[m++];
+    ret = ins[i].op == RET_OF;
+    int32_t* arg = in->arg;
+    *in = ins[i];
+    in->pc = call->pc;
+    switch (in->op) {
+      case CONST_OF:
+        arg[0] = add_const(code, body->objects->data[arg[0]]);
+        break;
+      case LOAD_OF:
+      case ASSIGN_TO:
+        arg[0] = inline_name(code, fn, body->names->data[arg[0]]);
+        break;
+      case STORE_NAME:
+        arg[0] = inline_type(code, body->types->data[arg[0]]);
+        arg[1] = inline_name(code, fn, body->names->data[arg[1]]);
+        break;
+      case RET_OF:
+        in->op = CHECK_TYPE;
+        in->line = call->line;
+        arg[0] = inline_type(code, fn->value.fn.ret);
+        break;
+    }
+  }
+  free(ins);
+  return m;
+}
+
+/* Replaces calls of small functions defined in the same code object with
+ * their bodies. Parameters and locals become names of the caller, stored
+ * after the type check of the call, and the result is checked against the
+ * return type. resolve_locals later gives the names frame slots, so they
+ * never reach the table of a module. Only calls the definition always
+ * runs before are inlined, and only when nothing else may bind the name
+ * of the function, so they could not have reached another one. */
+static instr* inline_calls(code_object* code, instr* ins, int* count) {
+  int n = *count, grow = 0;
+  int* site = malloc(sizeof(int) * (n + 1));
+  for (int i = 0; i < n; i++) {
+    site[i] = -1;
+  }
+  mark_targets(ins, n);
+  for (int f = 0; f < n; f++) {
+    if (ins[f].op != FUNCTION) {
+      continue;
+    }
+    object* fn = code->objects->data[ins[f].arg[0]];
+    int size = inline_size(fn);
+    if (size == -1 || rebound(code, ins, n, f, fn->value.fn.name)) {
+      continue;
+    }
+    bool* seen = reachable(ins, n, f);
+    for (int i = 0; i < n; i++) {
+      if (seen[i] || ins[i].op != LOAD_OF ||
+          strcmp(code->names->data[ins[i].arg[0]], fn->value.fn.name) != 0) {
+        continue;
+      }
+      int c = call_of(ins, n, i);
+      if (c != -1 && ins[c].arg[0] == fn->value.fn.k->item) {
+        site[i] = site[c] = f;
+        grow += 2 * fn->value.fn.k->item + size;
+      }
+    }
+    free(seen);
+  }
+  if (grow == 0) {
+    free(site);
+    return ins;
+  }
+
+  instr* out = malloc(sizeof(instr) * (n + grow + 1));
+  int m = 0;
+  for (int i = 0; i < n; i++) {
+    if (site[i] == -1) {
+      out[m++] = ins[i];
+    } else if (ins[i].op == LOAD_OF) {
+      out[m] = ins[i];
+      out[m++].live = false;
+    } else {
+      object* fn = code->objects->data[ins[site[i]].arg[0]];
+      m = expand(code, fn, &ins[i], out, m);
+    }
+  }
+  free(site);
+  free(ins);
+  *count = m;
+  return out;
+}
+
+/* Register operand of an expression leaf, -1 for any other instruction. */
+static int16_t reg_leaf(instr* in) {
+  if (in->arg[0] > R_INDEX_MAX) {
+    return -1;
+  }
+  switch (in->op) {
+    case LOAD_LOCAL:
+      return R_OPERAND(R_REG, in->arg[0]);
+    case CONST_OF:
+      return R_OPERAND(R_CONST, in->arg[0]);
+    case LOAD_OF:
+      return R_OPERAND(R_NAME, in->arg[0]);
+    default:
+      return -1;
+  }
+}
+
+/* Start of the tree of binary operators over leaves that ends at root, -1
+ * if it contains anything else or a jump lands inside it. */
+static int reg_tree(instr* ins, int root) {
+  int start = root;
+  int need = 1;
+  while (start != -1) {
+    if (binary(ins[start].op)) {
+      need++;
+    } else if (reg_leaf(&ins[start]) != -1) {
+      need--;
+    } else {
+      return -1;
+    }
+    if (need == 0) {
+      return start;
+    }
+    if (ins[start].target) {
+      return -1;
+    }
+    start = prev_live(ins, start);
+  }
+  return -1;
+}
+
+/* Where the value of a rewritten tree goes: a local or global it is
+ * assigned to, a conditional jump, or else the operand stack. */
+static void reg_sink(instr* ins, int n, int root) {
+  instr* r = &ins[root];
+  int next = next_live(ins, n, root);
+  r->arg[1] = R_OPERAND(R_STACK, 0);
+  if (next == n || ins[next].target) {
+    return;
+  }
+  instr* in = &ins[next];
+  switch (in->op) {
+    case ASSIGN_LOCAL:
+    case U_ASSIGN_LOCAL:
+      r->arg[1] = R_OPERAND(R_REG, in->arg[0]);
+      break;
+    case ASSIGN_TO:
+      if (in->arg[0] > R_INDEX_MAX) {
+        return;
+      }
+      r->arg[1] = R_OPERAND(R_NAME, in->arg[0]);
+      break;
+    case F_JUMP_TO:
+      if (r->arg[0] < TO_GR || r->arg[0] > TO_NOT_EQ) {
+        return;
+      }
+      r->op = REG_JUMP;
+      r->arg[1] = r->arg[2];
+      r->arg[2] = r->arg[3];
+      r->arg[3] = in->arg[0];
+      break;
+    default:
+      return;
+  }
+  kill(ins, n, next);
+}
+
+/* Rewrites trees of binary operators over locals, constants and names into
+ * three-address instructions. The root of a tree is its last instruction so
+ * the code is scanned backwards, temporaries are numbered by stack depth. */
+static void assign_registers(code_object* code, instr* ins, int n) {
+  int base = code->locals == NULL ? 0 : code->locals->item;
+  int16_t* stack = malloc(sizeof(int16_t) * n);
+  mark_targets(ins, n);
+
+  for (int root = n - 1; root >= 0; root--) {
+    if (!ins[root].live || !binary(ins[root].op)) {
+      continue;
+    }
+    int start = reg_tree(ins, root);
+    if (start == -1 || base + root - start > R_INDEX_MAX) {
+      continue;
+    }
+    int top = 0;
+    for (int i = start; i <= root; i = next_live(ins, n, i)) {
+      int16_t v = reg_leaf(&ins[i]);
+      if (v != -1) {
+        stack[top++] = v;
+        kill(ins, n, i);
+        continue;
+      }
+      int32_t* arg = ins[i].arg;
+      arg[0] = ins[i].op;
+      arg[3] = stack[--top];
+      arg[2] = stack[--top];
+      arg[1] = R_OPERAND(R_REG, base + top);
+      ins[i].op = REG_BINARY;
+      stack[top++] = arg[1];
+      if (top > code->regs) {
+        code->regs = top;
+      }
+    }
+    reg_sink(ins, n, root);
+  }
+  free(stack);
+}
+
+/* The i-th live instruction after at, -1 if it does not exist or a jump
+ * lands on it, in which case it cannot be merged into a superinstruction. */
+static int follow(instr* ins, int n, int at, int i) {
+  while (i-- > 0) {
+    at = next_live(ins, n, at);
+    if (at == n || ins[at].target) {
+      return -1;
+    }
+  }
+  return at;
+}
+
+/* Variable operand of a superinstruction for a LOAD_OF or LOAD_LOCAL. */
+static int16_t var(instr* in) {
+  return in->op == LOAD_LOCAL ? -1 - in->arg[0] : in->arg[0];
+}
+
+static bool assigns(instr* in, uint8_t op) {
+  return in->op == op || (op == ASSIGN_LOCAL && in->op == U_ASSIGN_LOCAL);
+}
+
+/* Replaces the most frequent opcode sequences with superinstructions. */
+static void fuse(instr* ins, int n) {
+  mark_targets(ins, n);
+  for (int i = 0; i < n; i++) {
+    if (!ins[i].live) {
+      continue;
+    }
+    uint8_t op = ins[i].op;
+    int a = follow(ins, n, i, 1);
+    if (a == -1) {
+      continue;
+    }
+    if (op >= TO_GR && op <= TO_NOT_EQ && ins[a].op == F_JUMP_TO) {
+      ins[i].op = CMP_JUMP;
+      ins[i].arg[0] = op;
+      ins[i].arg[1] = ins[a].arg[0];
+      kill(ins, n, a);
+      continue;
+    }
+    if (op != LOAD_OF && op != LOAD_LOCAL) {
+      continue;
+    }
+    int16_t v = var(&ins[i]);
+    int b = follow(ins, n, i, 2);
+    int c = follow(ins, n, i, 3);
+    if (ins[a].op == CONST_OF && b != -1 && ins[b].op == TO_ADD && c != -1 &&
+        assigns(&ins[c], op == LOAD_OF ? ASSIGN_TO : ASSIGN_LOCAL) &&
+        ins[c].arg[0] == ins[i].arg[0]) {
+      ins[i].op = ADD_TO;
+      ins[i].arg[0] = v;
+      ins[i].arg[1] = ins[a].arg[0];
+      kill(ins, n, a);
+      kill(ins, n, b);
+      kill(ins, n, c);
+      continue;
+    }
+    switch (ins[a].op) {
+      case CONST_OF:
+        ins[i].op = LOAD_CONST;
+        ins[i].arg[1] = ins[a].arg[0];
+        break;
+      case LOAD_OF:
+      case LOAD_LOCAL:
+        ins[i].op = LOAD_LOAD;
+        ins[i].arg[1] = var(&ins[a]);
+        break;
+      case CALL_FUNC:
+        ins[i].op = LOAD_CALL;
+        ins[i].arg[1] = ins[a].arg[0];
+        break;
+      default:
+        continue;
+    }
+    ins[i].arg[0] = v;
+    kill(ins, n, a);
+  }
+}
+
+/* Writes the live instructions back and moves jumps to the new offsets. */
+static void rebuild(code_object* code, instr* ins, int n) {
+  int* pc = malloc(sizeof(int) * (n + 1));
+  int len = 0, count = 0;
+  for (int i = 0; i < n; i++) {
+    pc[i] = len;
+    if (ins[i].live) {
+      len += CODE_SIZE(ins[i].op);
+      count++;
+    }
+  }
+  pc[n] = len;
+
+  uint8_t* codes = malloc(sizeof(uint8_t) * len);
+  line_table lines = {NULL, 0, 0, 0, 0};
+
+  for (int i = 0, p = 0; i < n; i++) {
+    if (!ins[i].live) {
+      continue;
+    }
+    int a = jump_operand(ins[i].op);
+    if (a != -1 && ins[i].arg[a] >= 0) {
+      ins[i].arg[a] = pc[resolve(ins, n, ins[i].arg[a])];
+    }
+    add_line(&lines, p, ins[i].line);
+    codes[p++] = ins[i].op;
+    for (int j = 0; j < code_operand[ins[i].op]; j++) {
+      int bytes = j == a ? 4 : 2;
+      for (int k = 0; k < bytes; k++) {
+        codes[p++] = (uint32_t)ins[i].arg[j] >> 8 * k & 0xff;
+      }
+    }
+  }
+  free(pc);
+
+  free(code->codes);
+  free(code->lines.data);
+  code->codes = codes;
+  code->len = len;
+  code->cap = len;
+  code->lines = lines;
+  code->count = count;
+}
+
+/* Drops constants no instruction refers to any more, folded operands and
+ * the bodies of removed branches included. */
+static void compact(code_object* code, instr* ins, int n) {
+  keg* objs = code->objects;
+  if (objs == NULL) {
+    return;
+  }
+  int* to = malloc(sizeof(int) * objs->item);
+  for (int i = 0; i < objs->item; i++) {
+    to[i] = -1;
+  }
+  keg* pool = NULL;
+#define KEEP(k)                               \
+  if (to[k] == -1) {                          \
+    pool = append_keg(pool, objs->data[k]);   \
+    to[k] = pool->item - 1;                   \
+  }
+  for (int i = 0; i < n; i++) {
+    int32_t* arg = ins[i].arg;
+    int a = obj_arg(ins[i].op);
+    if (!ins[i].live) {
+      continue;
+    }
+    if (a != -1) {
+      KEEP(arg[a]);
+      arg[a] = to[arg[a]];
+    }
+    if (ins[i].op != REG_BINARY && ins[i].op != REG_JUMP) {
+      continue;
+    }
+    for (int j = ins[i].op == REG_BINARY ? 2 : 1, end = j + 2; j < end; j++) {
+      if (R_KIND(arg[j]) == R_CONST) {
+        KEEP(R_INDEX(arg[j]));
+        arg[j] = R_OPERAND(R_CONST, to[R_INDEX(arg[j])]);
+      }
+    }
+  }
+#undef KEEP
+  free(to);
+  free_keg(objs);
+  code->objects = pool;
+}
+
+static void optimize_code(code_object* code, object* fn) {
+  int n = code->count;
+  instr* ins = decode(code);
+  if (!no_inline) {
+    ins = inline_calls(code, ins, &n);
+  }
+
+  bool changed;
+  do {
+    mark_targets(ins, n);
+    changed = fold(code, ins, n);
+    changed |= drop_jumps(ins, n);
+    changed |= drop_unreachable(ins, n);
+  } while (changed);
+  resolve_locals(code, fn == NULL ? NULL : fn->value.fn.k, ins, n);
+  check_types(code, fn, ins, n);
+  if (reg_mode) {
+    assign_registers(code, ins, n);
+  }
+  fuse(ins, n);
+
+  compact(code, ins, n);
+  rebuild(code, ins, n);
+  free(ins);
+
+  for (int i = 0; code->objects != NULL && i < code->objects->item; i++) {
+    object* obj = code->objects->data[i];
+    switch (obj->kind) {
+      case OBJ_FUNCTION:
+        optimize_code(obj->value.fn.code, obj);
+        break;
+      case OBJ_CLASS:
+        optimize_code(obj->value.cl.code, NULL);
+        break;
+      case OBJ_EBLOCK:
+        optimize_code(obj->value.eb.code, NULL);
+        break;
+    }
+  }
+}
+
+void optimize(code_object* code) {
+  optimize_code(code, NULL);
+}
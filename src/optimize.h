@@ -0,0 +1,23 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#ifndef FT_OPTIMIZE_H
+#define FT_OPTIMIZE_H
+
+#include <stdbool.h>
+
+#include "code.h"
+
+/* Compile arithmetic into the three-address register instructions. */
+extern bool reg_mode;
+
+/* Keep the calls of small functions instead of inlining their bodies. */
+extern bool no_inline;
+
+/* Folds constant expressions, removes unreachable instructions and unused
+ * constants. Nested functions, classes and blocks are optimized as well. */
+void optimize(code_object*);
+
+#endif
@@ -0,0 +1,315 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FNV_BASIS 2166136261u
+
+enum { POOL_OBJ, POOL_NAME, POOL_TYPE };
+
+typedef struct {
+  uint32_t hash;
+  uint8_t kind;
+  void* ptr;
+  keg* owner; /* keg the value was last added to */
+  int index;  /* and its index there */
+} entry;
+
+static entry* entries = NULL;
+static int cap = 0;
+static int used = 0;
+
+/* Modules are compiled on several threads at once. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t hash_bytes(uint32_t h, const void* ptr, size_t n) {
+  const uint8_t* p = ptr;
+  for (size_t i = 0; i < n; i++) {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h;
+}
+
+static bool literal(object* obj) {
+  return obj->kind <= OBJ_BOOL || obj->kind == OBJ_NIL;
+}
+
+static uint32_t obj_hash(object* obj) {
+  uint32_t h = hash_bytes(FNV_BASIS, &obj->kind, 1);
+  switch (obj->kind) {
+    case OBJ_INT:
+      return hash_bytes(h, &obj->value.num, sizeof(int));
+    case OBJ_FLOAT:
+      return hash_bytes(h, &obj->value.f, sizeof(double));
+    case OBJ_STRING:
+      return hash_bytes(h, obj->value.str, strlen(obj->value.str));
+    case OBJ_CHAR:
+      return hash_bytes(h, &obj->value.c, 1);
+    case OBJ_BOOL:
+      return hash_bytes(h, &obj->value.b, 1);
+    default:
+      return h;
+  }
+}
+
+/* Floats are compared by their bits so 0.0 and -0.0 stay apart. */
+static bool obj_same(object* a, object* b) {
+  if (a->kind != b->kind) {
+    return false;
+  }
+  switch (a->kind) {
+    case OBJ_INT:
+      return a->value.num == b->value.num;
+    case OBJ_FLOAT:
+      return memcmp(&a->value.f, &b->value.f, sizeof(double)) == 0;
+    case OBJ_STRING:
+      return strcmp(a->value.str, b->value.str) == 0;
+    case OBJ_CHAR:
+      return a->value.c == b->value.c;
+    case OBJ_BOOL:
+      return a->value.b == b->value.b;
+    default:
+      return true;
+  }
+}
+
+static uint32_t type_hash(uint32_t h, type* t) {
+  if (t == NULL) {
+    return hash_bytes(h, "", 1);
+  }
+  h = hash_bytes(h, &t->kind, 1);
+  switch (t->kind) {
+    case T_ARRAY:
+    case T_TUPLE:
+      return type_hash(h, (type*)t->inner.single);
+    case T_MAP:
+      h = type_hash(h, (type*)t->inner.both.T1);
+      return type_hash(h, (type*)t->inner.both.T2);
+    case T_FUNCTION: {
+      keg* arg = t->inner.fn.arg;
+      for (int i = 0; arg != NULL && i < arg->item; i++) {
+        h = type_hash(h, arg->data[i]);
+      }
+      return type_hash(h, (type*)t->inner.fn.ret);
+    }
+    case T_USER:
+      return hash_bytes(h, t->inner.name, strlen(t->inner.name));
+    case T_GENERIC:
+      return hash_bytes(h, &t, sizeof(type*));
+    default:
+      return h;
+  }
+}
+
+/* Structural equality, unlike type_eq which also accepts assignable types.
+ * Generics are only equal to themselves. */
+static bool type_same(type* a, type* b) {
+  if (a == NULL || b == NULL) {
+    return a == b;
+  }
+  if (a->kind != b->kind) {
+    return false;
+  }
+  switch (a->kind) {
+    case T_ARRAY:
+    case T_TUPLE:
+      return type_same((type*)a->inner.single, (type*)b->inner.single);
+    case T_MAP:
+      return type_same((type*)a->inner.both.T1, (type*)b->inner.both.T1) &&
+             type_same((type*)a->inner.both.T2, (type*)b->inner.both.T2);
+    case T_FUNCTION: {
+      keg* x = a->inner.fn.arg;
+      keg* y = b->inner.fn.arg;
+      if ((x == NULL) != (y == NULL) || (x != NULL && x->item != y->item)) {
+        return false;
+      }
+      for (int i = 0; x != NULL && i < x->item; i++) {
+        if (!type_same(x->data[i], y->data[i])) {
+          return false;
+        }
+      }
+      return type_same((type*)a->inner.fn.ret, (type*)b->inner.fn.ret);
+    }
+    case T_USER:
+      return strcmp(a->inner.name, b->inner.name) == 0;
+    case T_GENERIC:
+      return a == b;
+    default:
+      return true;
+  }
+}
+
+/* Names are compared with the n bytes at b, which need no terminator. */
+static bool same(uint8_t kind, void* a, void* b, int n) {
+  switch (kind) {
+    case POOL_OBJ:
+      return obj_same(a, b);
+    case POOL_NAME:
+      return strncmp(a, b, n) == 0 && ((char*)a)[n] == '\0';
+    default:
+      return type_same(a, b);
+  }
+}
+
+static void grow() {
+  entry* old = entries;
+  int n = cap;
+  cap = cap == 0 ? 256 : cap * 2;
+  entries = calloc(cap, sizeof(entry));
+  for (int i = 0; i < n; i++) {
+    if (old[i].ptr == NULL) {
+      continue;
+    }
+    int j = old[i].hash & (cap - 1);
+    while (entries[j].ptr != NULL) {
+      j = (j + 1) & (cap - 1);
+    }
+    entries[j] = old[i];
+  }
+  free(old);
+}
+
+/* The entry of the pooled value equal to ptr, or the empty one it would
+ * take. */
+static entry* find(uint8_t kind, uint32_t hash, void* ptr, int n) {
+  if ((used + 1) * 4 > cap * 3) {
+    grow();
+  }
+  int i = hash & (cap - 1);
+  while (entries[i].ptr != NULL) {
+    entry* e = &entries[i];
+    if (e->hash == hash && e->kind == kind && same(kind, e->ptr, ptr, n)) {
+      return e;
+    }
+    i = (i + 1) & (cap - 1);
+  }
+  return &entries[i];
+}
+
+/* The pooled value equal to ptr, which becomes the pooled one if there is
+ * none yet. */
+static entry* intern(uint8_t kind, uint32_t hash, void* ptr) {
+  int n = kind == POOL_NAME ? strlen(ptr) : 0;
+  entry* e = find(kind, hash, ptr, n);
+  if (e->ptr == NULL) {
+    used++;
+    *e = (entry){hash, kind, ptr, NULL, 0};
+  }
+  return e;
+}
+
+static int add(keg** g, entry* e) {
+  keg* k = *g;
+  if (k != NULL && e->owner == k && e->index < k->item &&
+      k->data[e->index] == e->ptr) {
+    return e->index;
+  }
+  /* A value never added before cannot be there yet. */
+  int i = e->owner == NULL && k != NULL ? k->item : 0;
+  while (k != NULL && i < k->item && k->data[i] != e->ptr) {
+    i++;
+  }
+  if (k == NULL || i == k->item) {
+    *g = append_keg(k, e->ptr);
+    i = (*g)->item - 1;
+  }
+  e->owner = *g;
+  e->index = i;
+  return i;
+}
+
+static entry* intern_obj(object* obj) {
+  entry* e = intern(POOL_OBJ, obj_hash(obj), obj);
+  if (e->ptr != obj && !immortal(obj)) {
+    free(obj);
+  }
+  return e;
+}
+
+static entry* intern_name(char* name) {
+  uint32_t h = hash_bytes(FNV_BASIS, name, strlen(name));
+  return intern(POOL_NAME, h, name);
+}
+
+/* A name spelled by n bytes of a source is only copied the first time. */
+static entry* intern_slice(const char* s, int n) {
+  uint32_t h = hash_bytes(FNV_BASIS, s, n);
+  entry* e = find(POOL_NAME, h, (void*)s, n);
+  if (e->ptr == NULL) {
+    char* name = malloc(n + 1);
+    memcpy(name, s, n);
+    name[n] = '\0';
+    used++;
+    *e = (entry){h, POOL_NAME, name, NULL, 0};
+  }
+  return e;
+}
+
+object* pool_obj(object* obj) {
+  obj = box(obj);
+  if (!literal(obj)) {
+    return obj;
+  }
+  pthread_mutex_lock(&lock);
+  object* v = intern_obj(obj)->ptr;
+  pthread_mutex_unlock(&lock);
+  return v;
+}
+
+char* pool_name(char* name) {
+  pthread_mutex_lock(&lock);
+  char* v = intern_name(name)->ptr;
+  pthread_mutex_unlock(&lock);
+  return v;
+}
+
+char* pool_slice(const char* s, int n) {
+  pthread_mutex_lock(&lock);
+  char* v = intern_slice(s, n)->ptr;
+  pthread_mutex_unlock(&lock);
+  return v;
+}
+
+int pool_add_obj(keg** g, object* obj) {
+  obj = box(obj);
+  if (!literal(obj)) {
+    *g = append_keg(*g, obj);
+    return (*g)->item - 1;
+  }
+  pthread_mutex_lock(&lock);
+  int i = add(g, intern_obj(obj));
+  pthread_mutex_unlock(&lock);
+  return i;
+}
+
+int pool_add_name(keg** g, char* name) {
+  pthread_mutex_lock(&lock);
+  int i = add(g, intern_name(name));
+  pthread_mutex_unlock(&lock);
+  return i;
+}
+
+int pool_add_slice(keg** g, const char* s, int n) {
+  pthread_mutex_lock(&lock);
+  int i = add(g, intern_slice(s, n));
+  pthread_mutex_unlock(&lock);
+  return i;
+}
+
+int pool_add_type(keg** g, type* t) {
+  pthread_mutex_lock(&lock);
+  entry* e = intern(POOL_TYPE, type_hash(FNV_BASIS, t), t);
+  if (e->ptr != t) {
+    free(t);
+  }
+  int i = add(g, e);
+  pthread_mutex_unlock(&lock);
+  return i;
+}
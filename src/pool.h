@@ -0,0 +1,34 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#ifndef FT_POOL_H
+#define FT_POOL_H
+
+#include "keg.h"
+#include "object.h"
+#include "type.h"
+
+/* Program-wide pool of literal constants, names and types. Equal values
+ * are kept once and shared by every code object, so they can be compared
+ * by pointer. Objects other than literals are never pooled, immediates are
+ * boxed first. The pool may be used from several threads. */
+object* pool_obj(object*);
+
+char* pool_name(char*);
+
+/* The pooled name spelled by the bytes of a source slice. */
+char* pool_slice(const char*, int);
+
+/* Index of the pooled value in the keg of a code object, appended on its
+ * first use. A duplicate object or type passed in is freed. */
+int pool_add_obj(keg**, object*);
+
+int pool_add_name(keg**, char*);
+
+int pool_add_slice(keg**, const char*, int);
+
+int pool_add_type(keg**, type*);
+
+#endif
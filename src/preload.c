@@ -0,0 +1,259 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#include "preload.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "object.h"
+#include "opcode.h"
+#include "source.h"
+#include "trace.h"
+#include "vm.h"
+
+#define MAX_WORKERS 8
+
+extern token_stream new_stream(const char*, int);
+extern keg* compile(token_stream*);
+
+__thread jmp_buf* trace_jump = NULL;
+
+enum { PENDING, RUNNING, DONE };
+
+typedef struct {
+  char* path;
+  uint8_t state;
+  code_object* code; /* NULL when it failed or was taken */
+} job;
+
+static keg* jobs = NULL;
+static char* main_name = NULL;
+static int next = 0;    /* first job that may still be pending */
+static int running = 0; /* jobs being compiled, they may add others */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+
+static job* find_job(const char* path) {
+  for (int i = 0; jobs != NULL && i < jobs->item; i++) {
+    job* j = jobs->data[i];
+    if (strcmp(j->path, path) == 0) {
+      return j;
+    }
+  }
+  return NULL;
+}
+
+/* Same lookup as load_module, without giving up when there is no such
+ * directory. Only source modules are compiled ahead. */
+static char* module_path(char* name, char* dir) {
+  DIR* d = opendir(dir);
+  if (d == NULL) {
+    return NULL;
+  }
+  char* addr = NULL;
+  struct dirent* p;
+  while (addr == NULL && (p = readdir(d)) != NULL) {
+    int len = strlen(p->d_name) - 1;
+    if (p->d_type != 8 || len < 2 || p->d_name[len] != 't' ||
+        p->d_name[len - 1] != 'f' || p->d_name[len - 2] != '.') {
+      continue;
+    }
+    if (filename_eq(p->d_name, name)) {
+      addr = malloc(strlen(dir) + strlen(p->d_name) + 2);
+      sprintf(addr, "%s/%s", dir, p->d_name);
+    }
+  }
+  closedir(d);
+  return addr;
+}
+
+/* Called with the lock held. */
+static void add_job(keg* cap) {
+  char* name = cap->data[cap->item - 1];
+  if (main_name != NULL && filename_eq(main_name, name)) {
+    return;
+  }
+  char dir[STRING_PATH_MAX] = ".";
+  if (cap->item > 1) {
+    dir[0] = '\0';
+    for (int i = 0; i < cap->item - 1; i++) {
+      if (strlen(dir) + strlen(cap->data[i]) + 2 > STRING_PATH_MAX) {
+        return;
+      }
+      strcat(dir, cap->data[i]);
+      strcat(dir, "/");
+    }
+  }
+  char* path = module_path(name, dir);
+  if (path == NULL) {
+    return;
+  }
+  if (find_job(path) != NULL) {
+    free(path);
+    return;
+  }
+  job* j = malloc(sizeof(job));
+  j->path = path;
+  j->state = PENDING;
+  j->code = NULL;
+  jobs = append_keg(jobs, j);
+  pthread_cond_broadcast(&ready);
+}
+
+/* Adds a job for every module the code uses. A path is the run of
+ * SET_NAME names right before USE_MOD or USE_IN_MOD. */
+static void find_uses(code_object* code) {
+  keg* cap = new_keg();
+  for (int p = 0; p < code->len; p += CODE_SIZE(code->codes[p])) {
+    uint8_t op = code->codes[p];
+    if (op == SET_NAME) {
+      cap = append_keg(cap, code->names->data[READ_OFF(code->codes, p + 1)]);
+      continue;
+    }
+    if (op == USE_MOD || op == USE_IN_MOD) {
+      int count = READ_OFF(code->codes, p + 1);
+      if (count > 0 && count <= cap->item) {
+        keg* path = new_keg();
+        for (int i = cap->item - count; i < cap->item; i++) {
+          path = append_keg(path, cap->data[i]);
+        }
+        add_job(path);
+        free_keg(path);
+      }
+    }
+    cap->item = 0;
+  }
+  free_keg(cap);
+
+  for (int i = 0; code->objects != NULL && i < code->objects->item; i++) {
+    object* obj = code->objects->data[i];
+    switch (obj->kind) {
+      case OBJ_FUNCTION:
+        find_uses(obj->value.fn.code);
+        break;
+      case OBJ_CLASS:
+        find_uses(obj->value.cl.code);
+        break;
+      case OBJ_EBLOCK:
+        find_uses(obj->value.eb.code);
+        break;
+    }
+  }
+}
+
+/* A failed lexer or compiler jumps back here and leaks what it built. */
+static void compile_job(job* j) {
+  code_object* code = load_cache(j->path);
+  if (code == NULL) {
+    source src;
+    if (!open_source(j->path, &src)) {
+      return;
+    }
+    jmp_buf env;
+    if (setjmp(env) != 0) {
+      trace_jump = NULL;
+      close_source(&src);
+      return;
+    }
+    trace_jump = &env;
+    token_stream tokens = new_stream(src.buf, src.size);
+    keg* codes = compile(&tokens);
+    code = codes->data[0];
+    free_keg(codes);
+    trace_jump = NULL;
+    dump_cache(j->path, &src, code);
+    close_source(&src);
+  }
+  j->code = code;
+}
+
+/* Waits for work as long as a job is pending or running, since a
+ * running one may still add the modules it uses. */
+static void* worker(void* arg) {
+  pthread_mutex_lock(&lock);
+  while (true) {
+    while (next < jobs->item && ((job*)jobs->data[next])->state != PENDING) {
+      next++;
+    }
+    if (next == jobs->item) {
+      if (running == 0) {
+        break;
+      }
+      pthread_cond_wait(&ready, &lock);
+      continue;
+    }
+    job* j = jobs->data[next];
+    j->state = RUNNING;
+    running++;
+    pthread_mutex_unlock(&lock);
+
+    compile_job(j);
+
+    pthread_mutex_lock(&lock);
+    j->state = DONE;
+    running--;
+    if (j->code != NULL) {
+      find_uses(j->code);
+    }
+    pthread_cond_broadcast(&ready);
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+void preload(code_object* code, const char* path) {
+  pthread_mutex_lock(&lock);
+  jobs = new_keg();
+  main_name = get_filename(path);
+  find_uses(code);
+  bool none = jobs->item == 0;
+  pthread_mutex_unlock(&lock);
+  if (none) {
+    return;
+  }
+  /* Modules used by the ones found here are added as they compile, so the
+   * pool is sized by the machine rather than by the first jobs. */
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1) {
+    n = 1;
+  }
+  if (n > MAX_WORKERS) {
+    n = MAX_WORKERS;
+  }
+  for (int i = 0; i < n; i++) {
+    pthread_t t;
+    if (pthread_create(&t, NULL, worker, NULL) == 0) {
+      pthread_detach(t);
+    }
+  }
+}
+
+code_object* take_preload(const char* path) {
+  pthread_mutex_lock(&lock);
+  job* j = find_job(path);
+  if (j == NULL) {
+    pthread_mutex_unlock(&lock);
+    return NULL;
+  }
+  /* Not started yet, it is compiled here with the errors reported. */
+  if (j->state == PENDING) {
+    j->state = DONE;
+  }
+  while (j->state == RUNNING) {
+    pthread_cond_wait(&ready, &lock);
+  }
+  code_object* code = j->code;
+  j->code = NULL;
+  pthread_mutex_unlock(&lock);
+  return code;
+}
@@ -0,0 +1,21 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#ifndef FT_PRELOAD_H
+#define FT_PRELOAD_H
+
+#include "code.h"
+
+/* Compiles the source modules used by a program ahead of time on worker
+ * threads, and the modules those use in turn. Evaluation still loads
+ * them in program order, only the lexing and compiling overlap. */
+void preload(code_object*, const char*);
+
+/* The code of the module at path compiled ahead. Waits while it is being
+ * compiled. NULL when the module was not found ahead, failed to compile or
+ * was already taken, and the caller then compiles it itself. */
+code_object* take_preload(const char*);
+
+#endif
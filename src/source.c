@@ -0,0 +1,101 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#include "source.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SOURCE_MMAP
+#endif
+
+/* Room for a chunk to be read after len bytes, keeping one for the
+ * terminator. Returns the size of the room. */
+static int reserve(char** buf, int len, int* cap) {
+  if (len + 1 >= *cap) {
+    *cap = *cap == 0 ? 4096 : *cap * 2;
+    *buf = realloc(*buf, *cap);
+  }
+  return *cap - len - 1;
+}
+
+/* Reads until the end, for files whose size is not known ahead. A pipe
+ * can only be opened once, so the descriptor already open is read. */
+#ifdef SOURCE_MMAP
+static bool read_source(int fd, source* s) {
+  char* buf = NULL;
+  int len = 0, cap = 0;
+  while (true) {
+    int room = reserve(&buf, len, &cap);
+    ssize_t n = read(fd, buf + len, room);
+    if (n <= 0) {
+      break;
+    }
+    len += n;
+  }
+  buf[len] = '\0';
+  close(fd);
+
+  *s = (source){buf, len, false};
+  return true;
+}
+#else
+static bool read_source(FILE* fp, source* s) {
+  if (fp == NULL) {
+    return false;
+  }
+  char* buf = NULL;
+  int len = 0, cap = 0;
+  while (true) {
+    int room = reserve(&buf, len, &cap);
+    size_t n = fread(buf + len, sizeof(char), room, fp);
+    if (n == 0) {
+      break;
+    }
+    len += n;
+  }
+  buf[len] = '\0';
+  fclose(fp);
+
+  *s = (source){buf, len, false};
+  return true;
+}
+#endif
+
+bool open_source(const char* path, source* s) {
+#ifdef SOURCE_MMAP
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      close(fd);
+      *s = (source){map, st.st_size, true};
+      return true;
+    }
+  }
+  return read_source(fd, s);
+#else
+  return read_source(fopen(path, "r"), s);
+#endif
+}
+
+void close_source(source* s) {
+#ifdef SOURCE_MMAP
+  if (s->mapped) {
+    munmap((void*)s->buf, s->size);
+    return;
+  }
+#endif
+  free((void*)s->buf);
+}
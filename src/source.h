@@ -0,0 +1,25 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#ifndef FT_SOURCE_H
+#define FT_SOURCE_H
+
+#include <stdbool.h>
+
+/* Text of a source file. Tokens are slices of it, so it stays open until
+ * they are compiled. */
+typedef struct {
+  const char* buf;
+  int size;
+  bool mapped;
+} source;
+
+/* Maps the file at path read-only, or reads it into memory when it cannot
+ * be mapped, as with pipes. False when it cannot be opened. */
+bool open_source(const char*, source*);
+
+void close_source(source*);
+
+#endif
@@ -29,13 +29,39 @@ void add_table(table* t, char* name, void* val) {
 
 void* get_table(table* t, char* name) {
   for (int i = 0; i < count_table(t); i++) {
-    if (strcmp(name, (char*)t->name->data[i]) == 0) {
+    char* key = t->name->data[i];
+    if (key == name || strcmp(name, key) == 0) {
+      return t->value->data[i];
+    }
+  }
+  return NULL;
+}
+
+/* get_table for a lookup repeated at one place. hint holds the index the
+ * name was found at the last time, which is tried first. */
+void* find_table(table* t, char* name, int* hint) {
+  int i = *hint;
+  if (i < count_table(t)) {
+    char* key = t->name->data[i];
+    if (key == name || strcmp(name, key) == 0) {
+      return t->value->data[i];
+    }
+  }
+  for (i = 0; i < count_table(t); i++) {
+    char* key = t->name->data[i];
+    if (key == name || strcmp(name, key) == 0) {
+      *hint = i;
       return t->value->data[i];
     }
   }
   return NULL;
 }
 
+void clear_table(table* t) {
+  t->name->item = 0;
+  t->value->item = 0;
+}
+
 void disassemble_table(table* t, const char* name) {
   printf("%s: %d item\n", name, count_table(t));
   for (int i = 0; i < count_table(t); i++) {
@@ -24,6 +24,10 @@ void add_table(table*, char*, void*);
 
 void* get_table(table*, char*);
 
+void* find_table(table*, char*, int*);
+
+void clear_table(table*);
+
 void disassemble_table(table*, const char*);
 
 void free_table(table*);
@@ -6,6 +6,7 @@
 #ifndef FT_TOKEN_H
 #define FT_TOKEN_H
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -71,9 +72,36 @@ static const char* token_string[] = {
 
 typedef struct {
   token_kind kind;
-  char* literal;
+  int start; /* literal as a slice of the source */
+  int len;
   int line;
   int off;
 } token;
 
+/* Tokens of part of a source lexed ahead. Their lines are counted from
+ * base. */
+typedef struct {
+  token* data;
+  int item;
+  int cap;
+  int base;
+} token_chunk;
+
+/* Tokens of a source, lexed one at a time as they are asked for. Their
+ * literals are not copied, so the source must outlive them. */
+typedef struct {
+  const char* src;
+  int size;
+  int i; /* where the next token is looked for */
+  int line;
+  int off; /* of the line being lexed */
+  bool new_line;
+  bool done; /* EOH was made */
+  int last;  /* line of the last token, -1 before the first */
+  token_chunk* chunks; /* when lexed ahead in parallel, served in order */
+  int count;
+  int chunk; /* served now */
+  int at;    /* next token in it */
+} token_stream;
+
 #endif
\ No newline at end of file
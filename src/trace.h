@@ -6,10 +6,23 @@
 #ifndef DRIFT_TRACE_H
 #define DRIFT_TRACE_H
 
+#include <setjmp.h>
+
 extern bool repl_mode;
-extern bool trace;
+extern __thread bool trace; /* an error was reported */
+
+/* Set while a module is compiled ahead or a part of a source is lexed
+ * ahead on a worker thread. An error there gives up instead of exiting,
+ * the work is done again when it is needed and the error reported then. */
+extern __thread jmp_buf* trace_jump;
+
+#define TRACE_JUMP()           \
+  if (trace_jump != NULL) {    \
+    longjmp(*trace_jump, 1);   \
+  }
 
 #define TRACE(fmt, ...)              \
+  TRACE_JUMP()                       \
   fprintf(stderr, fmt, __VA_ARGS__); \
   trace = true;                      \
   if (!repl_mode) {                  \
@@ -0,0 +1,368 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#include "verify.h"
+
+#include <stdlib.h>
+
+#include "object.h"
+#include "opcode.h"
+
+#define OP_COUNT (sizeof(code_operand) / sizeof(code_operand[0]))
+
+typedef struct {
+  code_object* code;
+  int slots;
+  int* depth; /* per byte offset, -1 until an instruction there is reached */
+  int* work;  /* offsets still to be followed */
+  int top;
+} checker;
+
+static int items(keg* g) {
+  return g == NULL ? 0 : g->item;
+}
+
+static bool in_range(int16_t i, int n) {
+  return i >= 0 && i < n;
+}
+
+static bool name_arg(checker* c, int16_t i) {
+  return in_range(i, items(c->code->names));
+}
+
+static bool type_arg(checker* c, int16_t i) {
+  return in_range(i, items(c->code->types)) && c->code->types->data[i];
+}
+
+static bool slot_arg(checker* c, int16_t i) {
+  return in_range(i, c->slots);
+}
+
+/* A local slot when negative, a name otherwise. */
+static bool var_arg(checker* c, int16_t v) {
+  return v < 0 ? slot_arg(c, -1 - v) : name_arg(c, v);
+}
+
+static bool obj_arg(checker* c, int16_t i, int kind) {
+  if (!in_range(i, items(c->code->objects))) {
+    return false;
+  }
+  object* obj = c->code->objects->data[i];
+  return kind == -1 || obj->kind == kind;
+}
+
+static bool reg_arg(checker* c, int16_t v, bool dst) {
+  int i = R_INDEX(v);
+  switch (R_KIND(v)) {
+    case R_REG:
+      return slot_arg(c, i);
+    case R_CONST:
+      return !dst && obj_arg(c, i, -1);
+    case R_NAME:
+      return name_arg(c, i);
+    default:
+      return dst;
+  }
+}
+
+static bool comparison(int16_t op) {
+  return op >= TO_GR && op <= TO_NOT_EQ;
+}
+
+static bool binary(int16_t op) {
+  return op >= TO_ADD && op <= TO_OR;
+}
+
+/* Records the depth the stack has when the instruction at pc starts. The
+ * end of the code is the only target past the last instruction, anything
+ * outside or inside an instruction is refused. */
+static bool reach(checker* c, int pc, int depth) {
+  if (pc == c->code->len) {
+    return true;
+  }
+  if (pc < 0 || pc > c->code->len || c->depth[pc] == -2) {
+    return false;
+  }
+  if (c->depth[pc] != -1) {
+    return c->depth[pc] == depth;
+  }
+  c->depth[pc] = depth;
+  c->work[c->top++] = pc;
+  return true;
+}
+
+/* Operands of the instruction at pc, the values it pops and pushes, the
+ * offset it may jump to if jumps is set and whether it goes on to the next
+ * one. */
+static bool check(checker* c, int pc, int* pop, int* push, int* jump,
+                  bool* jumps, bool* next) {
+  uint8_t* codes = c->code->codes;
+  uint8_t op = codes[pc];
+  int32_t a[4];
+  for (int i = 0; i < code_operand[op]; i++) {
+    a[i] = i == jump_operand(op) ? READ_JUMP(codes, pc + 1 + 2 * i)
+                                 : READ_OFF(codes, pc + 1 + 2 * i);
+  }
+  *pop = 0;
+  *push = 0;
+  *jump = 0;
+  *jumps = jump_operand(op) != -1;
+  *next = true;
+  switch (op) {
+    case CONST_OF:
+      *push = 1;
+      return obj_arg(c, a[0], -1);
+    case LOAD_OF:
+    case SET_NAME:
+      *push = 1;
+      return name_arg(c, a[0]);
+    case LOAD_LOCAL:
+      *push = 1;
+      return in_range(a[0], items(c->code->locals));
+    case ENUMERATE:
+      return obj_arg(c, a[0], OBJ_ENUMERATE);
+    case CLASS:
+      return obj_arg(c, a[0], OBJ_CLASS);
+    case FUNCTION:
+      return obj_arg(c, a[0], OBJ_FUNCTION);
+    case INTERFACE:
+      return obj_arg(c, a[0], OBJ_INTERFACE);
+    case SET_EB:
+      return obj_arg(c, a[0], OBJ_EBLOCK);
+    case ASSIGN_TO:
+      *pop = 1;
+      return name_arg(c, a[0]);
+    case ASSIGN_LOCAL:
+    case U_ASSIGN_LOCAL:
+      *pop = 1;
+      return slot_arg(c, a[0]);
+    case STORE_NAME:
+    case U_STORE_NAME:
+      *pop = 1;
+      return type_arg(c, a[0]) && name_arg(c, a[1]);
+    case STORE_LOCAL:
+    case U_STORE_LOCAL:
+      *pop = 1;
+      return type_arg(c, a[0]) && slot_arg(c, a[1]);
+    case CHECK_TYPE:
+      *pop = 1;
+      *push = 1;
+      return type_arg(c, a[0]);
+    case TO_INDEX:
+      *pop = 2;
+      *push = 1;
+      return true;
+    case TO_REPLACE:
+      *pop = 3;
+      return true;
+    case RANGE_OF:
+      *jump = a[2];
+      return name_arg(c, a[0]) && name_arg(c, a[1]);
+    case RANGE_GO:
+      *jump = a[1];
+      return name_arg(c, a[0]);
+    case GET_OF:
+    case REF_MODULE:
+      *pop = 1;
+      *push = 1;
+      return name_arg(c, a[0]) && in_range(a[1], c->code->sites);
+    case GET_IN_OF:
+      *push = 1;
+      return name_arg(c, a[0]) && in_range(a[1], c->code->sites);
+    case SET_OF:
+    case REF_SET:
+      *pop = 2;
+      return name_arg(c, a[0]);
+    case CALL_FUNC:
+      *pop = a[0] + 1;
+      *push = 1;
+      return a[0] >= 0;
+    case LOAD_CALL:
+      /* Its variable is pushed as the last argument of the call. */
+      *pop = a[1];
+      *push = 1;
+      return var_arg(c, a[0]) && a[1] >= 0;
+    case NEW_OBJ:
+      *pop = a[0] + 1;
+      *push = 1;
+      return a[0] >= 0 && a[0] % 2 == 0;
+    case USE_MOD:
+    case USE_IN_MOD:
+      *pop = a[0];
+      return a[0] > 0;
+    case BUILD_ARR:
+    case BUILD_TUP:
+    case BUILD_MAP:
+      *pop = a[0];
+      *push = 1;
+      return a[0] >= 0 && (op != BUILD_MAP || a[0] % 2 == 0);
+    case TO_BANG:
+    case TO_NOT:
+      *pop = 1;
+      *push = 1;
+      return true;
+    case JUMP_TO:
+      *jump = a[0];
+      *next = false;
+      return true;
+    case T_JUMP_TO:
+    case F_JUMP_TO:
+      *pop = 1;
+      *jump = a[0];
+      return true;
+    case TO_RET:
+      *next = false;
+      return true;
+    case RET_OF:
+      *pop = 1;
+      *next = false;
+      return true;
+    case RECV_EB:
+      /* Runs the block and leaves the code. */
+      *pop = 2;
+      *next = false;
+      return true;
+    case LOAD_CONST:
+      *push = 2;
+      return var_arg(c, a[0]) && obj_arg(c, a[1], -1);
+    case LOAD_LOAD:
+      *push = 2;
+      return var_arg(c, a[0]) && var_arg(c, a[1]);
+    case ADD_TO:
+      return var_arg(c, a[0]) && obj_arg(c, a[1], -1);
+    case CMP_JUMP:
+      *pop = 2;
+      *jump = a[1];
+      return comparison(a[0]);
+    case REG_BINARY:
+      *push = R_KIND(a[1]) == R_STACK;
+      return binary(a[0]) && reg_arg(c, a[1], true) &&
+             reg_arg(c, a[2], false) && reg_arg(c, a[3], false);
+    case REG_JUMP:
+      *jump = a[3];
+      return comparison(a[0]) && reg_arg(c, a[1], false) &&
+             reg_arg(c, a[2], false);
+    case DROP_TO:
+      return a[0] >= 0;
+    default:
+      if (!binary(op)) {
+        return false;
+      }
+      *pop = 2;
+      *push = 1;
+      return true;
+  }
+}
+
+static bool verify_code(code_object* code) {
+  int len = code->len;
+  checker c = {code, items(code->locals) + code->regs, NULL, NULL, 0};
+  c.depth = malloc(sizeof(int) * (len + 1));
+  c.work = malloc(sizeof(int) * (len + 1));
+
+  /* Offsets inside an instruction are marked so no jump may land there. */
+  bool ok = code->regs >= 0 && code->sites >= 0;
+  for (int p = 0; ok && p < len; p++) {
+    uint8_t op = code->codes[p];
+    ok = op < OP_COUNT && p + CODE_SIZE(op) <= len;
+    c.depth[p] = -1;
+    for (int i = 1; ok && i < CODE_SIZE(op); i++) {
+      c.depth[p + i] = -2;
+    }
+    if (ok) {
+      p += CODE_SIZE(op) - 1;
+    }
+  }
+
+  int most = 0;
+  ok = ok && reach(&c, 0, 0);
+  while (ok && c.top > 0) {
+    int pc = c.work[--c.top];
+    int depth = c.depth[pc];
+    int pop, push, jump;
+    bool jumps, next;
+    if (!check(&c, pc, &pop, &push, &jump, &jumps, &next) || pop > depth) {
+      ok = false;
+      break;
+    }
+    int after = depth - pop + push;
+    if (code->codes[pc] == LOAD_CALL && depth + 1 > most) {
+      most = depth + 1;
+    }
+    if (code->codes[pc] == DROP_TO) {
+      int16_t keep = READ_OFF(code->codes, pc + 1);
+      ok = keep <= depth;
+      after = keep;
+    }
+    if (after > most) {
+      most = after;
+    }
+    if (ok && jumps) {
+      ok = reach(&c, jump, after);
+    }
+    if (ok && next) {
+      ok = reach(&c, pc + CODE_SIZE(code->codes[pc]), after);
+    }
+  }
+  free(c.depth);
+  free(c.work);
+  code->stack = most;
+  return ok;
+}
+
+/* Entries the virtual machine uses without looking at them first. */
+static bool filled(keg* g) {
+  for (int i = 0; i < items(g); i++) {
+    if (g->data[i] == NULL) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* A call stores every argument by name, and in its slot when the function
+ * has locals. The variadic parameter comes last and has no type in v. */
+static bool verify_params(object* fn) {
+  keg* k = fn->value.fn.k;
+  keg* v = fn->value.fn.v;
+  code_object* code = fn->value.fn.code;
+  if (k == NULL || v == NULL || code == NULL || !filled(k) || !filled(v)) {
+    return false;
+  }
+  if (items(v) + (fn->value.fn.mutiple != NULL) != items(k)) {
+    return false;
+  }
+  return code->locals == NULL || items(code->locals) >= items(k);
+}
+
+bool verify(code_object* code) {
+  if (code == NULL || code->len < 0 ||
+      (code->codes == NULL && code->len != 0) || code->description == NULL ||
+      !filled(code->names) || !filled(code->locals) ||
+      !filled(code->types) || !verify_code(code)) {
+    return false;
+  }
+  for (int i = 0; i < items(code->objects); i++) {
+    object* obj = code->objects->data[i];
+    switch (obj->kind) {
+      case OBJ_FUNCTION:
+        if (!verify_params(obj) || !verify(obj->value.fn.code)) {
+          return false;
+        }
+        break;
+      case OBJ_CLASS:
+        if (!verify(obj->value.cl.code)) {
+          return false;
+        }
+        break;
+      case OBJ_EBLOCK:
+        if (!verify(obj->value.eb.code)) {
+          return false;
+        }
+        break;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,21 @@
+/* Drift
+ *
+ * 	- https://drift-lang.fun/
+ *
+ * GPL v3 License - bingxio <bingxio@qq.com> */
+#ifndef FT_VERIFY_H
+#define FT_VERIFY_H
+
+#include <stdbool.h>
+
+#include "code.h"
+
+/* Checks that every instruction of the code and of its nested functions,
+ * classes and blocks is whole, that its operands index into the tables of
+ * the code and its jumps land on instructions, and that the operand stack
+ * has the same depth on every path to an instruction and never runs
+ * empty. Sets the stack depth each code object needs, false when the code
+ * is not valid. */
+bool verify(code_object*);
+
+#endif
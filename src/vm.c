@@ -3,10 +3,13 @@
  * 	- https://drift-lang.fun/
  *
  * GPL v3 License - bingxio <bingxio@qq.com> */
+#include "cache.h"
+#include "preload.h"
+#include "source.h"
 #include "vm.h"
 
-extern keg* lexer(const char*, int);
-extern keg* compile(keg*);
+extern token_stream new_stream(const char*, int);
+extern keg* compile(token_stream*);
 
 vm_state vst;
 
@@ -45,54 +48,146 @@ object* get_cmods(char* name) {
   return NULL;
 }
 
-object* get_cmods_member(object* mod, char* name) {
+/* Variables come before methods, so only the hint of the methods has to
+ * wait for the variables to be searched. */
+object* get_cmods_member(object* mod, char* name, inline_cache* ic) {
   keg* a = mod->value.cm.var;
   keg* b = mod->value.cm.met;
 
-  for (int i = 0; i < a->item; i++) {
-    addr_kv* kv = a->data[i];
+  addr_kv* kv = ic->inner < a->item ? a->data[ic->inner] : NULL;
+  if (kv == NULL || strcmp(kv->name, name) != 0) {
+    kv = NULL;
+    for (int i = 0; i < a->item; i++) {
+      addr_kv* p = a->data[i];
 
-    if (strcmp(kv->name, name) == 0) {
-      void (*fn)() = kv->ptr;
-      fn();
-      find_cmod_var = true;
-      return NULL;
+      if (strcmp(p->name, name) == 0) {
+        kv = p;
+        ic->inner = i;
+        break;
+      }
+    }
+  }
+  if (kv != NULL) {
+    void (*fn)() = kv->ptr;
+    fn();
+    find_cmod_var = true;
+    return NULL;
+  }
+  if (ic->index < b->item) {
+    object* obj = b->data[ic->index];
+    if (strcmp(obj->value.cf.name, name) == 0) {
+      return obj;
     }
   }
   for (int i = 0; i < b->item; i++) {
     object* obj = b->data[i];
     if (strcmp(obj->value.cf.name, name) == 0) {
+      ic->index = i;
       return obj;
     }
   }
   return NULL;
 }
 
+static int frame_slots(code_object* code) {
+  return (code->locals == NULL ? 0 : code->locals->item) + code->regs;
+}
+
+/* Operand stack as deep as verify found the code needs, pushes and pops
+ * do not check it. */
+static keg* new_stack(code_object* code) {
+  keg* g = new_keg();
+  g->cap = code->stack == 0 ? 1 : code->stack;
+  g->data = malloc(sizeof(void*) * g->cap);
+  return g;
+}
+
+/* Empties the frame of a function for the call it makes in tail position,
+ * which runs in place of the caller. */
+void reuse_frame(frame* f, code_object* code) {
+  int n = frame_slots(code);
+  if (n != f->slots) {
+    free(f->local);
+    f->local = n == 0 ? NULL : calloc(n, sizeof(object*));
+  } else if (n != 0) {
+    memset(f->local, 0, sizeof(object*) * n);
+  }
+  f->code = code;
+  f->slots = n;
+  f->data->item = 0;
+  if (f->data->cap < code->stack) {
+    f->data->cap = code->stack;
+    f->data->data = realloc(f->data->data, sizeof(void*) * f->data->cap);
+  }
+  f->ret = NULL;
+  clear_table(f->tb);
+  clear_table(f->tp);
+  for (int i = 0; i < f->range->item; i++) {
+    free(f->range->data[i]);
+  }
+  f->range->item = 0;
+}
+
+/* Frames given back by free_frame, a call takes one of them instead of
+ * allocating a frame with its stack and tables. */
+static keg* spare = NULL;
+
 frame* new_frame(code_object* code) {
-  frame* f = malloc(sizeof(frame));
+  frame* f = spare == NULL ? NULL : pop_back_keg(spare);
+  if (f != NULL) {
+    reuse_frame(f, code);
+    f->fn = NULL;
+    f->self = NULL;
+    f->mark = 0;
+    return f;
+  }
+  f = malloc(sizeof(frame));
   f->code = code;
-  f->data = new_keg();
+  f->data = new_stack(code);
   f->ret = NULL;
   f->tb = new_table();
   f->tp = new_table();
   f->range = new_keg();
+  f->local = NULL;
+  f->fn = NULL;
+  f->self = NULL;
+  f->slots = frame_slots(code);
+  f->mark = 0;
+  if (f->slots != 0) {
+    f->local = calloc(f->slots, sizeof(object*));
+  }
   return f;
 }
 
-void free_frame(frame* f) {
-  printf("free GC\n");
+/* Whether a call from the frame f in tail position may leave the check of
+ * its result to the caller of f, which checks it against the return type of
+ * the function of f. The callee must want the class frame f was called
+ * with, a method only calls another of the same object this way. */
+bool tail_call(frame* f, object* fn) {
+  object* up = f->fn;
+  type* a = up->value.fn.ret;
+  type* b = fn->value.fn.ret;
+  if (a == NULL || b == NULL || fn->value.fn.self != f->self) {
+    return false;
+  }
+  return up == fn || fn->value.fn.code->typed ||
+         (a->kind == b->kind && copy_type(a));
 }
 
-void free_tokens(keg* g) {
-  for (int i = 0; i < g->item; i++) {
-    token* tok = (token*)g->data[i];
-    if (tok->kind == FLOAT || tok->kind == NUMBER || tok->kind == CHAR ||
-        tok->kind >= 40) {
-      free(tok->literal);
-    }
-    free(tok);
+void free_frame(frame* f) {
+  if (spare == NULL || spare->item < FRAME_SPARE_MAX) {
+    spare = append_keg(spare, f);
+    return;
+  }
+  for (int i = 0; i < f->range->item; i++) {
+    free(f->range->data[i]);
   }
-  free_keg(g);
+  free_keg(f->range);
+  free_keg(f->data);
+  free_table(f->tb);
+  free_table(f->tp);
+  free(f->local);
+  free(f);
 }
 
 #define BACK_FRAME (frame*)back_keg(vst.frame)
@@ -103,21 +198,23 @@ void free_tokens(keg* g) {
 #define TOP_CODE (BACK_FRAME)->code
 #define TOP_DATA (BACK_FRAME)->data
 #define TOP_ITER (BACK_FRAME)->range
+#define TOP_LOCAL (BACK_FRAME)->local
 
-#define PUSH(obj) TOP_DATA = append_keg(TOP_DATA, obj)
-#define POP (object*)pop_back_keg(TOP_DATA)
+#define PUSH(obj) (TOP_DATA->data[TOP_DATA->item++] = (obj))
+#define POP ((object*)TOP_DATA->data[--TOP_DATA->item])
 
-#define GET_OFF *(int16_t*)TOP_CODE->offsets->data[vst.op++]
+#define GET_OFF (vst.ip += 2, READ_OFF(TOP_CODE->codes, vst.ip - 2))
+#define GET_JUMP (vst.ip += 4, READ_JUMP(TOP_CODE->codes, vst.ip - 4))
 #define GET_NAME (char*)TOP_CODE->names->data[GET_OFF]
 #define GET_TYPE (type*)TOP_CODE->types->data[GET_OFF]
 #define GET_OBJ (object*)TOP_CODE->objects->data[GET_OFF]
-#define GET_LINE *(int*)TOP_CODE->lines->data[vst.ip]
-#define GET_CODE *(uint8_t*)TOP_CODE->codes->data[vst.ip]
+#define GET_LINE get_line(TOP_CODE, vst.ip)
+#define GET_CODE TOP_CODE->codes[vst.ip++]
 
-#define GET_PR_CODE *(uint8_t*)TOP_CODE->codes->data[vst.ip - 2]
-#define GET_PR_OBJ           \
-  (object*)TOP_CODE->objects \
-      ->data[(*(int16_t*)TOP_CODE->offsets->data[vst.op - 1])]
+/* The instruction being executed ends at ip. */
+int get_line(code_object* code, int ip) {
+  return find_line(&code->lines, ip > 0 ? ip - 1 : 0);
+}
 
 void type_error(type* T, object* obj) {
   fprintf(stderr, "\033[1;31mvm %d:\033[0m expect type %s, but it's %s.\n",
@@ -191,10 +288,7 @@ void bt_len(keg* arg) {
   if (obj == NULL || arg->item != 0) {
     bt_simple_error("len(obj any)");
   }
-  object* len = malloc(sizeof(object));
-  len->kind = OBJ_INT;
-  len->value.num = obj_len(obj);
-  PUSH(len);
+  PUSH(new_num(obj_len(obj)));
 }
 
 void bt_type(keg* arg) {
@@ -202,54 +296,48 @@ void bt_type(keg* arg) {
   if (obj == NULL || arg->item != 0) {
     bt_simple_error("type(obj any)");
   }
-  object* str = malloc(sizeof(object));
-  str->kind = OBJ_STRING;
-  str->value.str = (char*)obj_type_string(obj);
-  PUSH(str);
+  PUSH(new_string((char*)obj_type_string(obj)));
 }
 
 void bt_sleep(keg* arg) {
   object* obj = pop_back_keg(arg);
-  if (obj == NULL || obj->kind != OBJ_INT || arg->item != 0) {
+  if (obj == NULL || kind_of(obj) != OBJ_INT || arg->item != 0) {
     bt_simple_error("sleep(milliseconds int)");
   }
 #if defined(__linux__) || defined(__APPLE__)
-  sleep(obj->value.num / 1000);
+  sleep(num_of(obj) / 1000);
 #elif defined(_WIN32)
-  Sleep(obj->value.num);
+  Sleep(num_of(obj));
 #endif
 }
 
 void bt_rand_int(keg* arg) {
   object* b = pop_back_keg(arg);
   object* a = pop_back_keg(arg);
-  if (a == NULL || b == NULL || a->kind != OBJ_INT || b->kind != OBJ_INT ||
-      arg->item != 0) {
+  if (a == NULL || b == NULL || kind_of(a) != OBJ_INT ||
+      kind_of(b) != OBJ_INT || arg->item != 0) {
     bt_simple_error("rand(start, end int)");
   }
-  int x = b->value.num;
-  int y = a->value.num;
+  int x = num_of(b);
+  int y = num_of(a);
 
-  object* obj = malloc(sizeof(object));
-  obj->kind = OBJ_INT;
-
-  if (x == 0 && y == 0) {
-    obj->value.num = -1;
-  } else {
+  int num = -1;
+  if (x != 0 || y != 0) {
 #include <sys/time.h>
 #include <time.h>
     struct timeval stamp;
     gettimeofday(&stamp, NULL);
     srand(stamp.tv_usec);
-    obj->value.num = rand() % y + x;
+    num = rand() % y + x;
   }
-  PUSH(obj);
+  PUSH(new_num(num));
 }
 
 void bt_append_entry(keg* arg) {
   object* arr = pop_back_keg(arg);
   object* val = pop_back_keg(arg);
-  if (arr == NULL || arr->kind != OBJ_ARRAY || val == NULL || arg->item != 0) {
+  if (arr == NULL || kind_of(arr) != OBJ_ARRAY || val == NULL ||
+      arg->item != 0) {
     bt_simple_error("append(arr []any, new any)");
   }
   type* T = arr->value.arr.T;
@@ -260,11 +348,11 @@ void bt_append_entry(keg* arg) {
 void bt_remove_entry(keg* arg) {
   object* arr = pop_back_keg(arg);
   object* idx = pop_back_keg(arg);
-  if (arr == NULL || arr->kind != OBJ_ARRAY || idx == NULL ||
-      idx->kind != OBJ_INT || arg->item != 0) {
+  if (arr == NULL || kind_of(arr) != OBJ_ARRAY || idx == NULL ||
+      kind_of(idx) != OBJ_INT || arg->item != 0) {
     bt_simple_error("remove(arr []any, index int)");
   }
-  int p = idx->value.num;
+  int p = num_of(idx);
   keg* elem = arr->value.arr.element;
   if (elem->item == 0) {
     error("empty array can not to remove entry");
@@ -279,27 +367,22 @@ void bt_input(keg* arg) {
   if (arg->item != 0) {
     bt_simple_error("input()");
   }
-  char* literal = malloc(sizeof(char) * 32);
+  /* The line is kept right after the object and freed with it. */
+  object* obj = gc_alloc(sizeof(object) + 32);
+  char* literal = (char*)(obj + 1);
   fgets(literal, 32, stdin);
   literal[strlen(literal) - 1] = '\0';
-  object* obj = malloc(sizeof(object));
   obj->kind = OBJ_STRING;
   obj->value.str = literal;
   PUSH(obj);
 }
 
 object* bt_true() {
-  object* obj = malloc(sizeof(object));
-  obj->kind = OBJ_BOOL;
-  obj->value.b = true;
-  return obj;
+  return new_bool(true);
 }
 
 object* bt_false() {
-  object* obj = malloc(sizeof(object));
-  obj->kind = OBJ_BOOL;
-  obj->value.b = false;
-  return obj;
+  return new_bool(false);
 }
 
 builtin bts[BUILTIN_COUNT] = {{"println", BU_FUNCTION, bt_println},
@@ -317,7 +400,7 @@ builtin bts[BUILTIN_COUNT] = {{"println", BU_FUNCTION, bt_println},
                               {"false", BU_NAME, bt_false}};
 
 object* new_builtin(char* name, builtin_kind kind, void* p) {
-  object* obj = malloc(sizeof(object));
+  object* obj = calloc(1, sizeof(object));
   obj->kind = OBJ_BUILTIN;
   obj->value.bu.kind = kind;
   obj->value.bu.name = name;
@@ -326,9 +409,22 @@ object* new_builtin(char* name, builtin_kind kind, void* p) {
 }
 
 object* make_nil() {
-  object* obj = malloc(sizeof(object));
-  obj->kind = OBJ_NIL;
-  return obj;
+  return new_nil();
+}
+
+/* Result of a call that returns nothing. Every call leaves one value so
+ * verify knows the depth of the stack, the REPL does not print this one. */
+static object no_value = {.kind = OBJ_NIL};
+
+/* Leaves exactly one result of a C function on the stack above base. */
+void settle(int base) {
+  keg* data = TOP_DATA;
+  if (data->item == base) {
+    PUSH(&no_value);
+  } else if (data->item > base + 1) {
+    data->data[base] = data->data[data->item - 1];
+    data->item = base + 1;
+  }
 }
 
 object* get_builtin(char* name) {
@@ -341,7 +437,11 @@ object* get_builtin(char* name) {
   if (i != BUILTIN_COUNT) {
     builtin b = bts[i];
     if (b.kind == BU_FUNCTION) {
-      return new_builtin(name, b.kind, b.func);
+      static object* fns[BUILTIN_COUNT];
+      if (fns[i] == NULL) {
+        fns[i] = new_builtin(b.name, b.kind, b.func);
+      }
+      return fns[i];
     }
     if (b.kind == BU_NAME) {
       object* (*call)() = b.func;
@@ -351,6 +451,15 @@ object* get_builtin(char* name) {
   return NULL;
 }
 
+/* The inline cache of a member access site of the running code. */
+inline_cache* get_cache(int16_t site) {
+  code_object* code = TOP_CODE;
+  if (code->ic == NULL) {
+    code->ic = calloc(code->sites, sizeof(inline_cache));
+  }
+  return &code->ic[site];
+}
+
 range_iter* get_iter(char* name) {
   for (int i = 0; i < TOP_ITER->item; i++) {
     range_iter* iter = TOP_ITER->data[i];
@@ -361,53 +470,6 @@ range_iter* get_iter(char* name) {
   return NULL;
 }
 
-void jump(int16_t to) {
-  vst.op--;
-  bool reverse = vst.ip > to;
-  if (reverse) {
-    vst.ip--;
-  }
-  while (reverse ? vst.ip >= to : vst.ip < to) {
-    switch (GET_CODE) {
-      case CONST_OF:
-      case LOAD_OF:
-      case ENUMERATE:
-      case FUNCTION:
-      case INTERFACE:
-      case ASSIGN_TO:
-      case GET_OF:
-      case SET_OF:
-      case CALL_FUNC:
-      case SET_NAME:
-      case USE_MOD:
-      case USE_IN_MOD:
-      case BUILD_ARR:
-      case BUILD_TUP:
-      case BUILD_MAP:
-      case JUMP_TO:
-      case T_JUMP_TO:
-      case F_JUMP_TO:
-      case NEW_OBJ:
-      case REF_MODULE:
-      case SET_EB:
-        reverse ? vst.op-- : vst.op++;
-        break;
-      case STORE_NAME:
-      case RANGE_OF:
-      case RANGE_GO:
-        if (reverse)
-          vst.op -= 2;
-        else
-          vst.op += 2;
-        break;
-    }
-    reverse ? vst.ip-- : vst.ip++;
-  }
-  if (!reverse) {
-    vst.ip--;
-  }
-}
-
 void* lookup(char* name) {
   void* p = get_table(TOP_TB, name);
   if (p != NULL) {
@@ -438,6 +500,30 @@ void* lookup(char* name) {
   return NULL;
 }
 
+object* load_name(char* name) {
+  void* ptr = lookup(name);
+  if (ptr == NULL) {
+    undefined_error(name);
+  }
+  return ptr;
+}
+
+/* A local that has not been stored yet still resolves like a global. */
+object* load_local(int16_t i) {
+  object* obj = TOP_LOCAL[i];
+  if (obj == NULL) {
+    obj = load_name(TOP_CODE->locals->data[i]);
+  }
+  return obj;
+}
+
+object* load_var(int16_t v) {
+  if (v < 0) {
+    return load_local(-1 - v);
+  }
+  return load_name(TOP_CODE->names->data[v]);
+}
+
 void load_module(char*, char*, bool);
 
 void check_interface(object* in, object* cl) {
@@ -456,7 +542,7 @@ void check_interface(object* in, object* cl) {
       error("class does not contain some member");
     }
     object* fn = p;
-    if (fn->kind != OBJ_FUNCTION) {
+    if (kind_of(fn) != OBJ_FUNCTION) {
       error("an interface can only be a method");
     }
     if (!type_eq(m->ret, fn->value.fn.ret)) {
@@ -503,7 +589,7 @@ generic* exist_generic(keg* gt, char* tpname) {
 }
 
 void check_set(object* origin, object* new) {
-  if (new->kind != origin->kind && origin->kind != OBJ_NIL) {
+  if (kind_of(new) != kind_of(origin) && kind_of(origin) != OBJ_NIL) {
     error("wrong type set");
   }
   if (!obj_kind_eq(new, origin)) {
@@ -511,21 +597,129 @@ void check_set(object* origin, object* new) {
   }
 }
 
+/* An interface takes the class assigned to it, false is returned then and
+ * the value itself must not be stored. */
+bool assign_check(object* origin, object* obj) {
+  if (!obj_kind_eq(origin, obj)) {
+    error("inconsistent type");
+  }
+  if (kind_of(origin) == OBJ_INTERFACE) {
+    if (kind_of(obj) != OBJ_CLASS) {
+      error("interface needs to be assigned by class");
+    }
+    check_interface(origin, obj);
+    origin->value.in.class = (struct object*)obj;
+    return false;
+  }
+  return true;
+}
+
+void assign_var(int16_t v, object* obj) {
+  if (!assign_check(load_var(v), obj)) {
+    return;
+  }
+  if (v < 0) {
+    TOP_LOCAL[-1 - v] = obj;
+  } else {
+    add_table(TOP_TB, TOP_CODE->names->data[v], obj);
+  }
+}
+
+object* binary_eval(uint8_t op, object* a, object* b) {
+  if (kind_of(a) == OBJ_INT && kind_of(b) == OBJ_INT) {
+    double x = num_of(a);
+    double y = num_of(b);
+    switch (op) {
+      case TO_ADD:
+        return new_num((int)(x + y));
+      case TO_SUB:
+        return new_num((int)(x - y));
+      case TO_MUL:
+        return new_num((int)(x * y));
+    }
+  }
+  if (kind_of(a) == OBJ_STRING && kind_of(b) == OBJ_STRING) {
+    int la = strlen(a->value.str);
+    int lb = strlen(b->value.str);
+    if (la + lb > STRING_EVAL_MAX) {
+      error(
+          "number of characters is greater "
+          "than 1024-bit bytes");
+    }
+  }
+  return binary_op(op, a, b);
+}
+
+/* Integers are compared in place, no boolean object is allocated. */
+bool compare(uint8_t op, object* a, object* b) {
+  if (kind_of(a) != OBJ_INT || kind_of(b) != OBJ_INT) {
+    return bool_of(binary_eval(op, a, b));
+  }
+  int x = num_of(a);
+  int y = num_of(b);
+  switch (op) {
+    case TO_GR:
+      return x > y;
+    case TO_GR_EQ:
+      return x >= y;
+    case TO_LE:
+      return x < y;
+    case TO_LE_EQ:
+      return x <= y;
+    case TO_EQ_EQ:
+      return x == y;
+    default:
+      return x != y;
+  }
+}
+
+object* reg_load(int16_t v) {
+  switch (R_KIND(v)) {
+    case R_REG:
+      return load_local(R_INDEX(v));
+    case R_CONST:
+      return TOP_CODE->objects->data[R_INDEX(v)];
+    default:
+      return load_name(TOP_CODE->names->data[R_INDEX(v)]);
+  }
+}
+
+void reg_store(int16_t v, object* obj) {
+  keg* locals = TOP_CODE->locals;
+  switch (R_KIND(v)) {
+    case R_REG:
+      if (locals != NULL && R_INDEX(v) < locals->item) {
+        assign_var(-1 - R_INDEX(v), obj);
+      } else {
+        TOP_LOCAL[R_INDEX(v)] = obj;
+      }
+      break;
+    case R_NAME:
+      assign_var(R_INDEX(v), obj);
+      break;
+    default:
+      PUSH(obj);
+  }
+}
+
 void eval() {
-  while (vst.ip < TOP_CODE->codes->item) {
+  while (vst.ip < TOP_CODE->len) {
+    if (gc_due) {
+      collect();
+    }
     uint8_t code = GET_CODE;
     switch (code) {
       case CONST_OF: {
         PUSH(GET_OBJ);
         break;
       }
-      case STORE_NAME: {
+      case STORE_NAME:
+      case STORE_LOCAL: {
         type* T = GET_TYPE;
-        char* name = GET_NAME;
+        int16_t off = GET_OFF;
         object* obj = POP;
-        if (T->kind == T_BOOL && obj->kind == OBJ_INT) {
-          obj->value.b = obj->value.num > 0;
-          obj->kind = OBJ_BOOL;
+        if (T->kind == T_BOOL && kind_of(obj) == OBJ_INT) {
+          obj = num_of(obj) > 0 ? bt_true() : bt_false();
         }
         if (T->kind == T_USER) {
           type* tp = get_table(TOP_TP, T->inner.name);
@@ -534,13 +728,13 @@ void eval() {
             check_generic((generic*)tp->inner.ge, obj);
             T = tp;
           } else {
-            if (obj->kind == OBJ_CLASS) {
+            if (kind_of(obj) == OBJ_CLASS) {
               void* p = lookup(T->inner.name);
               if (p == NULL) {
                 error("undefined interface or class");
               }
               object* in = p;
-              if (in->kind == OBJ_INTERFACE) {
+              if (kind_of(in) == OBJ_INTERFACE) {
                 check_interface(in, obj);
                 in->value.in.class = (struct object*)obj;
                 obj = in;
@@ -551,7 +745,7 @@ void eval() {
           check_type(T, obj);
         }
 
-        switch (obj->kind) {
+        switch (kind_of(obj)) {
           case OBJ_ARRAY:
             obj->value.arr.T = (type*)T->inner.single;
             break;
@@ -564,45 +758,76 @@ void eval() {
             break;
         }
 
-        object* new = obj;
-        if (copy_type(T)) {
-          new = malloc(sizeof(object));
-          memcpy(new, obj, sizeof(object));
-        }
+        object* new = unbox(obj);
 
+        if (code == STORE_LOCAL) {
+          TOP_LOCAL[off] = new;
+          break;
+        }
+        char* name = TOP_CODE->names->data[off];
         add_table(TOP_TB, name, new);
         add_table(TOP_TP, name, T);
         break;
       }
-      case LOAD_OF: {
-        char* name = GET_NAME;
-        void* ptr = lookup(name);
-        if (ptr == NULL) {
-          undefined_error(name);
-        }
-        PUSH(ptr);
+      case CHECK_TYPE: {
+        check_type(GET_TYPE, back_keg(TOP_DATA));
         break;
       }
-      case ASSIGN_TO: {
-        char* name = GET_NAME;
-        object* obj = POP;
-        void* p = lookup(name);
-        if (p == NULL) {
-          undefined_error(name);
-        }
-        object* origin = p;
-        if (!obj_kind_eq(origin, obj)) {
-          error("inconsistent type");
-        }
-        if (origin->kind == OBJ_INTERFACE) {
-          if (obj->kind != OBJ_CLASS) {
-            error("interface needs to be assigned by class");
-          }
-          check_interface(origin, obj);
-          origin->value.in.class = (struct object*)obj;
+      case DROP_TO: {
+        TOP_DATA->item = GET_OFF;
+        break;
+      }
+      case U_STORE_NAME:
+      case U_STORE_LOCAL: {
+        type* T = GET_TYPE;
+        int16_t off = GET_OFF;
+        object* new = unbox(POP);
+        if (code == U_STORE_LOCAL) {
+          TOP_LOCAL[off] = new;
           break;
         }
-        add_table(TOP_TB, name, obj);
+        char* name = TOP_CODE->names->data[off];
+        add_table(TOP_TB, name, new);
+        add_table(TOP_TP, name, T);
+        break;
+      }
+      case LOAD_OF: {
+        PUSH(load_name(GET_NAME));
+        break;
+      }
+      case LOAD_LOCAL: {
+        PUSH(load_local(GET_OFF));
+        break;
+      }
+      case LOAD_CONST: {
+        PUSH(load_var(GET_OFF));
+        PUSH(GET_OBJ);
+        break;
+      }
+      case LOAD_LOAD: {
+        PUSH(load_var(GET_OFF));
+        PUSH(load_var(GET_OFF));
+        break;
+      }
+      case ASSIGN_TO: {
+        int16_t off = GET_OFF;
+        assign_var(off, POP);
+        break;
+      }
+      case ASSIGN_LOCAL: {
+        int16_t off = GET_OFF;
+        assign_var(-1 - off, POP);
+        break;
+      }
+      case U_ASSIGN_LOCAL: {
+        int16_t off = GET_OFF;
+        TOP_LOCAL[off] = POP;
+        break;
+      }
+      case ADD_TO: {
+        int16_t v = GET_OFF;
+        object* k = GET_OBJ;
+        assign_var(v, binary_eval(TO_ADD, load_var(v), k));
         break;
       }
       case TO_ADD:
@@ -620,21 +845,40 @@ void eval() {
       case TO_OR: {
         object* b = POP;
         object* a = POP;
-        if (a->kind == OBJ_STRING && b->kind == OBJ_STRING) {
-          int la = strlen(a->value.str);
-          int lb = strlen(b->value.str);
-          if (la + lb > STRING_EVAL_MAX) {
-            error(
-                "number of characters is greater "
-                "than 1024-bit bytes");
-          }
+        PUSH(binary_eval(code, a, b));
+        break;
+      }
+      case REG_BINARY: {
+        uint8_t op = GET_OFF;
+        int16_t dst = GET_OFF;
+        object* a = reg_load(GET_OFF);
+        object* b = reg_load(GET_OFF);
+        reg_store(dst, binary_eval(op, a, b));
+        break;
+      }
+      case REG_JUMP: {
+        uint8_t op = GET_OFF;
+        object* a = reg_load(GET_OFF);
+        object* b = reg_load(GET_OFF);
+        int off = GET_JUMP;
+        if (!compare(op, a, b)) {
+          vst.ip = off;
+        }
+        break;
+      }
+      case CMP_JUMP: {
+        uint8_t op = GET_OFF;
+        int off = GET_JUMP;
+        object* b = POP;
+        object* a = POP;
+        if (!compare(op, a, b)) {
+          vst.ip = off;
         }
-        PUSH(binary_op(code, a, b));
         break;
       }
       case BUILD_ARR: {
         int16_t item = GET_OFF;
-        object* obj = malloc(sizeof(object));
+        object* obj = gc_alloc(sizeof(object));
         obj->kind = OBJ_ARRAY;
         obj->value.arr.element = new_keg();
         if (item == 0) {
@@ -650,7 +894,7 @@ void eval() {
       }
       case BUILD_TUP: {
         int16_t item = GET_OFF;
-        object* obj = malloc(sizeof(object));
+        object* obj = gc_alloc(sizeof(object));
         obj->kind = OBJ_TUPLE;
         obj->value.tup.element = new_keg();
         if (item == 0) {
@@ -666,7 +910,7 @@ void eval() {
       }
       case BUILD_MAP: {
         int16_t item = GET_OFF;
-        object* obj = malloc(sizeof(object));
+        object* obj = gc_alloc(sizeof(object));
         obj->kind = OBJ_MAP;
         obj->value.map.k = new_keg();
         obj->value.map.v = new_keg();
@@ -687,37 +931,37 @@ void eval() {
       case TO_INDEX: {
         object* p = POP;
         object* obj = POP;
-        if (obj->kind != OBJ_ARRAY && obj->kind != OBJ_TUPLE &&
-            obj->kind != OBJ_STRING && obj->kind != OBJ_MAP) {
+        if (kind_of(obj) != OBJ_ARRAY && kind_of(obj) != OBJ_TUPLE &&
+            kind_of(obj) != OBJ_STRING && kind_of(obj) != OBJ_MAP) {
           error(
               "only array, tuple, string and map can be called "
               "with subscipt");
         }
-        if (obj->kind == OBJ_ARRAY) {
-          if (p->kind != OBJ_INT) {
+        if (kind_of(obj) == OBJ_ARRAY) {
+          if (kind_of(p) != OBJ_INT) {
             error("get value using integer subscript");
           }
           keg* elem = obj->value.arr.element;
 
-          if (elem->item == 0 || p->value.num >= elem->item) {
+          if (elem->item == 0 || num_of(p) >= elem->item) {
             PUSH(make_nil());
             break;
           }
-          PUSH(elem->data[p->value.num]);
+          PUSH(elem->data[num_of(p)]);
         }
-        if (obj->kind == OBJ_TUPLE) {
-          if (p->kind != OBJ_INT) {
+        if (kind_of(obj) == OBJ_TUPLE) {
+          if (kind_of(p) != OBJ_INT) {
             error("get value using integer subscript");
           }
           keg* elem = obj->value.tup.element;
 
-          if (elem->item == 0 || p->value.num >= elem->item) {
+          if (elem->item == 0 || num_of(p) >= elem->item) {
             PUSH(make_nil());
             break;
           }
-          PUSH(obj->value.tup.element->data[p->value.num]);
+          PUSH(obj->value.tup.element->data[num_of(p)]);
         }
-        if (obj->kind == OBJ_MAP) {
+        if (kind_of(obj) == OBJ_MAP) {
           if (obj->value.map.k->item == 0) {
             error("map entry is empty");
           }
@@ -732,19 +976,16 @@ void eval() {
             PUSH(make_nil());
           }
         }
-        if (obj->kind == OBJ_STRING) {
-          if (p->kind != OBJ_INT) {
+        if (kind_of(obj) == OBJ_STRING) {
+          if (kind_of(p) != OBJ_INT) {
             error("get value using integer subscript");
           }
           int len = strlen(obj->value.str);
-          if (len == 0 || p->value.num >= len) {
+          if (len == 0 || num_of(p) >= len) {
             PUSH(make_nil());
             break;
           }
-          object* ch = malloc(sizeof(object));
-          ch->kind = OBJ_CHAR;
-          ch->value.c = obj->value.str[p->value.num];
-          PUSH(ch);
+          PUSH(new_char(obj->value.str[num_of(p)]));
         }
         break;
       }
@@ -752,15 +993,15 @@ void eval() {
         object* obj = POP;
         object* idx = POP;
         object* j = POP;
-        if (j->kind != OBJ_ARRAY && j->kind != OBJ_MAP) {
+        if (kind_of(j) != OBJ_ARRAY && kind_of(j) != OBJ_MAP) {
           error("only array and map types can be set");
         }
-        if (j->kind == OBJ_ARRAY) {
-          if (idx->kind != OBJ_INT) {
+        if (kind_of(j) == OBJ_ARRAY) {
+          if (kind_of(idx) != OBJ_INT) {
             error("get value using integer subscript");
           }
           check_type(j->value.arr.T, obj);
-          int p = idx->value.num;
+          int p = num_of(idx);
           if (j->value.arr.element->item == 0) {
             insert_keg(j->value.arr.element, 0, obj);
           } else {
@@ -770,7 +1011,7 @@ void eval() {
             replace_keg(j->value.arr.element, p, obj);
           }
         }
-        if (j->kind == OBJ_MAP) {
+        if (kind_of(j) == OBJ_MAP) {
           check_type(j->value.map.T1, idx);
           check_type(j->value.map.T2, obj);
           int p = -1;
@@ -791,43 +1032,35 @@ void eval() {
       }
       case TO_BANG: {
         object* obj = POP;
-        object* new = malloc(sizeof(object));
-        switch (obj->kind) {
+        bool b = false;
+        switch (kind_of(obj)) {
           case OBJ_INT:
-            new->value.b = !obj->value.num;
+            b = !num_of(obj);
             break;
           case OBJ_FLOAT:
-            new->value.b = !obj->value.f;
+            b = !float_of(obj);
             break;
           case OBJ_CHAR:
-            new->value.b = !obj->value.c;
+            b = !char_of(obj);
             break;
           case OBJ_STRING:
-            new->value.b = !strlen(obj->value.str);
+            b = !strlen(obj->value.str);
             break;
           case OBJ_BOOL:
-            new->value.b = !obj->value.b;
+            b = !bool_of(obj);
             break;
-          default:
-            new->value.b = false;
         }
-        new->kind = OBJ_BOOL;
-        PUSH(new);
+        PUSH(new_bool(b));
         break;
       }
       case TO_NOT: {
         object* obj = POP;
-        object* new = malloc(sizeof(object));
-        if (obj->kind == OBJ_INT) {
-          new->value.num = -obj->value.num;
-          new->kind = OBJ_INT;
-          PUSH(new);
+        if (kind_of(obj) == OBJ_INT) {
+          PUSH(new_num(-num_of(obj)));
           break;
         }
-        if (obj->kind == OBJ_FLOAT) {
-          new->value.f = -obj->value.f;
-          new->kind = OBJ_FLOAT;
-          PUSH(new);
+        if (kind_of(obj) == OBJ_FLOAT) {
+          PUSH(new_float(-float_of(obj)));
           break;
         }
         unsupport_operand_error(code_string[code]);
@@ -836,17 +1069,17 @@ void eval() {
       case JUMP_TO:
       case F_JUMP_TO:
       case T_JUMP_TO: {
-        int16_t off = GET_OFF;
+        int off = GET_JUMP;
         if (code == JUMP_TO) {
-          jump(off);
+          vst.ip = off;
           break;
         }
-        bool ok = (POP)->value.b;
+        bool ok = bool_of(POP);
         if (code == T_JUMP_TO && ok) {
-          jump(off);
+          vst.ip = off;
         }
         if (code == F_JUMP_TO && ok == false) {
-          jump(off);
+          vst.ip = off;
         }
         break;
       }
@@ -855,29 +1088,39 @@ void eval() {
         add_table(TOP_TB, obj->value.fn.name, obj);
         break;
       }
+      case LOAD_CALL:
+        PUSH(load_var(GET_OFF));
+        /* fall through */
       case CALL_FUNC: {
         int16_t off = GET_OFF;
         keg* arg = new_keg();
         while (off > 0) {
-          if (TOP_DATA->item - 1 <= 0) {
-            error("stack overflow!");
-          }
           append_keg(arg, POP);
           off--;
         }
 
         object* fn = POP;
 
-        if (fn->kind == OBJ_CFUNC) {
+        if (kind_of(fn) == OBJ_CFUNC) {
+          int base = TOP_DATA->item;
+          /* C modules may read the fields of their arguments. */
+          for (int i = 0; i < arg->item; i++) {
+            arg->data[i] = box(arg->data[i]);
+          }
           fn->value.cf.func(arg);
+          free_keg(arg);
+          settle(base);
           goto next;
         }
-        if (fn->kind == OBJ_BUILTIN) {
+        if (kind_of(fn) == OBJ_BUILTIN) {
+          int base = TOP_DATA->item;
           void (*call)(keg*) = fn->value.bu.func;
           call(arg);
+          free_keg(arg);
+          settle(base);
           goto next;
         }
-        if (fn->kind != OBJ_FUNCTION) {
+        if (kind_of(fn) != OBJ_FUNCTION) {
           error("i don't known what was called");
         }
 
@@ -890,7 +1133,19 @@ void eval() {
           error("inconsistent funtion arguments");
         }
 
-        frame* f = new_frame(fn->value.fn.code);
+        /* A call right before a return reuses the frame of the function
+         * making it and goes on in this loop, so tail recursion takes no
+         * C stack. */
+        frame* f = BACK_FRAME;
+        bool tail = f->fn != NULL && vst.ip < TOP_CODE->len &&
+                    TOP_CODE->codes[vst.ip] == RET_OF && tail_call(f, fn);
+        if (tail) {
+          reuse_frame(f, fn->value.fn.code);
+        } else {
+          f = new_frame(fn->value.fn.code);
+          f->self = fn->value.fn.self;
+        }
+        f->fn = fn;
         keg* gt = fn->value.fn.gt;
 
         for (int i = 0; i < k->item; i++) {
@@ -900,7 +1155,7 @@ void eval() {
 
           if (v->item == i && fn->value.fn.mutiple != NULL) {
             type* T = fn->value.fn.mutiple;
-            object* a = malloc(sizeof(object));
+            object* a = gc_alloc(sizeof(object));
             a->kind = OBJ_ARRAY;
             a->value.arr.element = NULL;
 
@@ -938,17 +1193,24 @@ void eval() {
             }
             obj = p;
           }
-          add_table(f->tb, name, obj);
+          if (f->code->locals != NULL) {
+            f->local[i] = obj;
+          } else {
+            add_table(f->tb, name, obj);
+          }
         }
+        free_keg(arg);
 
+        if (tail) {
+          vst.ip = 0;
+          break;
+        }
         if (fn->value.fn.self != NULL) {
           vst.call = append_keg(vst.call, fn->value.fn.self);
         }
 
-        int16_t op_up = vst.op;
-        int16_t ip_up = vst.ip;
+        int ip_up = vst.ip;
 
-        vst.op = 0;
         vst.ip = 0;
         vst.frame = append_keg(vst.frame, f);
         eval();
@@ -956,23 +1218,22 @@ void eval() {
         frame* p = pop_back_keg(vst.frame);
 
         if (recv_excep) {
-          if (fn->value.fn.ret != NULL) {
-            PUSH(make_nil());
-          }
+          PUSH(fn->value.fn.ret != NULL ? make_nil() : &no_value);
           recv_excep = false;
+        } else if (fn->value.fn.ret == NULL) {
+          PUSH(&no_value);
         } else {
-          if (fn->value.fn.ret != NULL) {
-            if (p->ret == NULL || !type_checker(fn->value.fn.ret, p->ret)) {
-              if (p->ret == NULL) {
-                error("function missing return value");
-              }
-              type_error(fn->value.fn.ret, p->ret);
+          if (p->ret == NULL || (!fn->value.fn.code->typed &&
+                                 !type_checker(fn->value.fn.ret, p->ret))) {
+            if (p->ret == NULL) {
+              error("function missing return value");
             }
-            PUSH(p->ret);
+            type_error(fn->value.fn.ret, p->ret);
           }
+          PUSH(p->ret);
         }
 
-        vst.op = op_up;
+        free_frame(p);
         vst.ip = ip_up;
 
         if (fn->value.fn.self != NULL) {
@@ -992,53 +1253,62 @@ void eval() {
       }
       case GET_OF: {
         char* name = GET_NAME;
+        inline_cache* ic = get_cache(GET_OFF);
         object* obj = POP;
-        if (obj->kind != OBJ_ENUMERATE && obj->kind != OBJ_CLASS &&
-            obj->kind != OBJ_INTERFACE) {
+        if (kind_of(obj) != OBJ_ENUMERATE && kind_of(obj) != OBJ_CLASS &&
+            kind_of(obj) != OBJ_INTERFACE) {
           error("only enum, interface and class type are supported");
         }
-        if (obj->kind == OBJ_ENUMERATE) {
+        if (kind_of(obj) == OBJ_ENUMERATE) {
           keg* elem = obj->value.en.element;
 
-          object* p = malloc(sizeof(object));
-          p->kind = OBJ_INT;
-          p->value.num = -1;
-          for (int i = 0; i < elem->item; i++) {
+          int p = -1;
+          if (ic->index < elem->item &&
+              strcmp(name, (char*)elem->data[ic->index]) == 0) {
+            p = ic->index;
+          }
+          for (int i = 0; p == -1 && i < elem->item; i++) {
             if (strcmp(name, (char*)elem->data[i]) == 0) {
-              p->value.num = i;
-              break;
+              p = ic->index = i;
             }
           }
-          PUSH(p);
+          PUSH(new_num(p));
         }
-        if (obj->kind == OBJ_CLASS) {
+        if (kind_of(obj) == OBJ_CLASS) {
           if (obj->value.cl.init == false) {
             error("class did not load initialization members");
           }
           frame* fr = (frame*)obj->value.cl.fr;
-          void* ptr = get_table(fr->tb, name);
+          void* ptr = find_table(fr->tb, name, &ic->index);
           if (ptr == NULL) {
             error("nonexistent member");
           }
           object* val = ptr;
-          if (val->kind == OBJ_FUNCTION) {
+          if (kind_of(val) == OBJ_FUNCTION) {
             val->value.fn.self = obj->value.cl.fr;
           }
           PUSH(ptr);
         }
-        if (obj->kind == OBJ_INTERFACE) {
+        if (kind_of(obj) == OBJ_INTERFACE) {
           if (obj->value.in.class == NULL) {
             error("interface is not initialized");
           }
           keg* elem = obj->value.in.element;
-          for (int i = 0; i < elem->item; i++) {
+          int i = ic->inner;
+          if (i >= elem->item ||
+              strcmp(((method*)elem->data[i])->name, name) != 0) {
+            i = 0;
+          }
+          for (; i < elem->item; i++) {
             method* m = elem->data[i];
             if (strcmp(m->name, name) == 0) {
               object* cl = (object*)obj->value.in.class;
               frame* fr = (frame*)cl->value.cl.fr;
-              object* val = get_table(fr->tb, name);
+              object* val = find_table(fr->tb, name, &ic->index);
+
+              ic->inner = i;
 
-              if (val->kind == OBJ_FUNCTION) {
+              if (kind_of(val) == OBJ_FUNCTION) {
                 val->value.fn.self = fr;
               }
               PUSH(val);
@@ -1051,10 +1321,19 @@ void eval() {
       }
       case GET_IN_OF: {
         char* name = GET_NAME;
+        inline_cache* ic = get_cache(GET_OFF);
         if (vst.call->item < 2) {
           error("need to use this statement in the class");
         }
-        void* ptr = lookup(name);
+        /* Same order as lookup, only the frame of the class is cached. */
+        void* ptr = get_table(TOP_TB, name);
+        if (ptr == NULL) {
+          frame* f = (frame*)back_keg(vst.call);
+          ptr = find_table(f->tb, name, &ic->index);
+        }
+        if (ptr == NULL) {
+          ptr = lookup(name);
+        }
         if (ptr == NULL) {
           error("nonexistent member");
         }
@@ -1065,7 +1344,7 @@ void eval() {
         char* name = GET_NAME;
         object* val = POP;
         object* obj = POP;
-        if (obj->kind != OBJ_CLASS) {
+        if (kind_of(obj) != OBJ_CLASS) {
           error("only members of class can be set");
         }
         frame* fr = (frame*)obj->value.cl.fr;
@@ -1079,19 +1358,22 @@ void eval() {
       }
       case REF_MODULE: {
         char* name = GET_NAME;
+        inline_cache* ic = get_cache(GET_OFF);
         object* obj = POP;
-        if (obj->kind != OBJ_MODULE && obj->kind != OBJ_CMODS) {
+        int base = TOP_DATA->item;
+        if (kind_of(obj) != OBJ_MODULE && kind_of(obj) != OBJ_CMODS) {
           error("can only be used as a member reference of a module");
         }
         void* ptr = NULL;
-        if (obj->kind == OBJ_MODULE) {
-          ptr = get_table((table*)obj->value.mod.tb, name);
+        if (kind_of(obj) == OBJ_MODULE) {
+          ptr = find_table((table*)obj->value.mod.tb, name, &ic->index);
         }
-        if (obj->kind == OBJ_CMODS) {
-          ptr = get_cmods_member(obj, name);
+        if (kind_of(obj) == OBJ_CMODS) {
+          ptr = get_cmods_member(obj, name, ic);
         }
         if (find_cmod_var) {
           find_cmod_var = false;
+          settle(base);
           break;
         }
         if (ptr == NULL) {
@@ -1104,7 +1386,7 @@ void eval() {
         char* name = GET_NAME;
         object* val = POP;
         object* obj = POP;
-        if (obj->kind != OBJ_MODULE) {
+        if (kind_of(obj) != OBJ_MODULE) {
           error("module members can only be set");
         }
         table* tb = (table*)obj->value.mod.tb;
@@ -1124,24 +1406,20 @@ void eval() {
       case NEW_OBJ: {
         int16_t arg = GET_OFF;
 
-        keg* k = NULL;
-        keg* v = NULL;
-
-        while (arg > 0) {
-          v = append_keg(v, POP);
-          k = append_keg(k, POP);
-          arg -= 2;
-        }
-
-        object* obj = POP;
-        if (obj->kind != OBJ_CLASS) {
+        /* The class and the pairs of member names and values stay on the
+         * stack while the body runs, where the collector finds them. */
+        int base = TOP_DATA->item - arg - 1;
+        object* obj = TOP_DATA->data[base];
+        if (kind_of(obj) != OBJ_CLASS) {
           error("only class object can be created");
         }
 
-        object* new = malloc(sizeof(object));
+        object* new = gc_alloc(sizeof(object));
         memcpy(new, obj, sizeof(object));
+        TOP_DATA->data[base] = new;
 
         frame* f = new_frame(obj->value.cl.code);
+        track_frame(f);
 
         new->value.cl.fr = (struct frame*)f;
         keg* gt = new->value.cl.gt;
@@ -1152,10 +1430,8 @@ void eval() {
           add_table(f->tp, ((generic*)T->inner.ge)->name, T);
         }
 
-        int16_t op_up = vst.op;
-        int16_t ip_up = vst.ip;
+        int ip_up = vst.ip;
 
-        vst.op = 0;
         vst.ip = 0;
         vst.frame = append_keg(vst.frame, new->value.cl.fr);
         eval();
@@ -1167,52 +1443,48 @@ void eval() {
           i--;
         }
 
-        vst.op = op_up;
         vst.ip = ip_up;
 
-        if (k != NULL) {
-          for (int i = 0; i < k->item; i++) {
-            char* key = ((object*)k->data[i])->value.str;
-            object* obj = v->data[i];
-            type* T = get_table(f->tp, key);
-            if (T == NULL) {
-              undefined_error(key);
-            }
-            if (T->kind == T_GENERIC) {
-              check_generic((generic*)T->inner.ge, obj);
-            } else {
-              check_type(T, obj);
-            }
-            add_table(f->tb, key, obj);
+        for (int i = TOP_DATA->item - 2; i > base; i -= 2) {
+          char* key = ((object*)TOP_DATA->data[i])->value.str;
+          object* obj = TOP_DATA->data[i + 1];
+          type* T = get_table(f->tp, key);
+          if (T == NULL) {
+            undefined_error(key);
+          }
+          if (T->kind == T_GENERIC) {
+            check_generic((generic*)T->inner.ge, obj);
+          } else {
+            check_type(T, obj);
           }
+          add_table(f->tb, key, obj);
         }
 
         new->value.cl.init = true;
+        TOP_DATA->item = base;
         PUSH(new);
         break;
       }
       case SET_NAME: {
-        char* name = GET_NAME;
-        object* n = malloc(sizeof(object));
-        n->kind = OBJ_STRING;
-        n->value.str = name;
-        PUSH(n);
+        PUSH(new_string(GET_NAME));
         break;
       }
       case RANGE_OF: {
         char* name = GET_NAME;
-        char* list = TOP_CODE->names
-                         ->data[*(int16_t*)TOP_CODE->offsets->data[vst.op - 2]];
-        object* obj = get_table(TOP_TB, list);
-        int16_t out = GET_OFF;
+        char* list = GET_NAME;
+        int out = GET_JUMP;
 
-        if (obj->kind != OBJ_ARRAY) {
+        object* obj = get_table(TOP_TB, list);
+        if (obj == NULL) {
+          undefined_error(list);
+        }
+        if (kind_of(obj) != OBJ_ARRAY) {
           error("receive a array object to range it");
         }
 
         keg* elem = obj->value.arr.element;
         if (elem->item == 0) {
-          jump(out);
+          vst.ip = out;
           break;
         }
 
@@ -1223,6 +1495,7 @@ void eval() {
           iter = malloc(sizeof(range_iter));
           iter->p = 0;
           iter->arr = elem;
+          iter->obj = obj;
           iter->name = name;
 
           TOP_ITER = append_keg(TOP_ITER, iter);
@@ -1233,21 +1506,20 @@ void eval() {
       }
       case RANGE_GO: {
         char* name = GET_NAME;
-        int16_t go = GET_OFF;
+        int go = GET_JUMP;
 
         range_iter* iter = get_iter(name);
         keg* arr = iter->arr;
 
         if (iter->p + 1 == arr->item) {
-          pop_back_keg(TOP_ITER);
+          free(pop_back_keg(TOP_ITER));
           break;
         }
 
         iter->p++;
         add_table(TOP_TB, name, iter->arr->data[iter->p]);
 
-        vst.op -= 1;
-        jump(go);
+        vst.ip = go;
         break;
       }
       case SET_EB: {
@@ -1259,7 +1531,7 @@ void eval() {
         object* val = POP;
         object* obj = POP;
 
-        if (obj->kind != OBJ_EBLOCK) {
+        if (kind_of(obj) != OBJ_EBLOCK) {
           error("not and exception code block");
         }
 
@@ -1269,32 +1541,24 @@ void eval() {
         frame* f = new_frame(code);
         add_table(f->tb, name, val);
 
-        int16_t bop = vst.op;
-        int16_t bip = vst.ip;
-
-        vst.op = 0;
         vst.ip = 0;
         vst.frame = append_keg(vst.frame, f);
         eval();
-        pop_back_keg(vst.frame);
+        free_frame(pop_back_keg(vst.frame));
 
-        vst.op = bop;
-        vst.ip = TOP_CODE->codes->item;
+        vst.ip = TOP_CODE->len;
         recv_excep = true;
         break;
       }
       case TO_RET:
       case RET_OF: {
-        vst.ip = TOP_CODE->codes->item;
+        vst.ip = TOP_CODE->len;
         vst.loop_ret = true;
         if (code == RET_OF) {
-          if (GET_PR_CODE == FUNCTION) {
-            (BACK_FRAME)->ret = GET_PR_OBJ;
-          } else {
-            (BACK_FRAME)->ret = POP;
-          }
+          (BACK_FRAME)->ret = POP;
         }
-        if (repl_mode && TOP_DATA->item >= 1) {
+        if (repl_mode && TOP_DATA->item >= 1 &&
+            back_keg(TOP_DATA) != &no_value) {
           printf("%s\n", obj_raw_string(back_keg(TOP_DATA), false));
         }
         break;
@@ -1327,8 +1591,7 @@ void eval() {
         exit(EXIT_SUCCESS);
       }
     }
-  next:
-    vst.ip++;
+  next:;
   }
 }
 
@@ -1365,22 +1628,25 @@ vm_state evaluate(code_object* code, char* filename) {
   }
 
   vst.ip = 0;
-  vst.op = 0;
   vst.filename = filename;
 
-  frame* main = new_frame(code);
-  if (repl_mode) {
-    if (vst.frame->item == 0) {
-      new_env(main);
-    }
+  if (repl_mode && vst.frame->item != 0) {
     frame* top = vst.frame->data[0];
     top->code = code;
-    top->data = new_keg();
+    free_keg(top->data);
+    top->data = new_stack(code);
+    /* Slots only live for the line that made them. */
+    free(top->local);
+    top->slots = frame_slots(code);
+    top->local =
+        top->slots == 0 ? NULL : calloc(top->slots, sizeof(object*));
   } else {
-    new_env(main);
+    new_env(new_frame(code));
   }
 
+  bool up = gc_enable(true);
   eval();
+  gc_enable(up);
 
   return vst;
 }
@@ -1432,55 +1698,64 @@ keg* read_path(char* path, char a, char b) {
 }
 
 void load_eval(const char* path, char* name, bool internal) {
-  FILE* fp = fopen(path, "r");
-  if (fp == NULL) {
-    printf("\033[1;31mvm %d:\033[0m failed to read buffer of file '%s'\n",
-           GET_LINE, path);
-    exit(EXIT_SUCCESS);
+  keg* codes = NULL;
+
+  /* The constants of the module are kept, not collected. */
+  bool up = gc_enable(false);
+  code_object* code = take_preload(path);
+  if (code == NULL) {
+    code = load_cache(path);
+  }
+  if (code == NULL) {
+    source src;
+    if (!open_source(path, &src)) {
+      printf("\033[1;31mvm %d:\033[0m failed to read buffer of file '%s'\n",
+             GET_LINE, path);
+      exit(EXIT_SUCCESS);
+    }
+    token_stream tokens = new_stream(src.buf, src.size);
+    codes = compile(&tokens);
+    code = codes->data[0];
+    dump_cache(path, &src, code);
+    close_source(&src);
   }
-  fseek(fp, 0, SEEK_END);
-  int fsize = ftell(fp);
-  rewind(fp);
-  char* buf = malloc(fsize + 1);
+  gc_enable(up);
 
-  fread(buf, sizeof(char), fsize, fp);
-  buf[fsize] = '\0';
-
-  int16_t ip_up = vst.ip;
-  int16_t op_up = vst.op;
+  int ip_up = vst.ip;
 
   keg* fr_up = vst.frame;
   keg* cl_up = vst.call;
+  vst.up = append_keg(vst.up, fr_up);
+  vst.up = append_keg(vst.up, cl_up);
 
-  keg* tokens = lexer(buf, fsize);
-  free(buf);
-
-  keg* codes = compile(tokens);
-  vm_state vs = evaluate(codes->data[0], get_filename(path));
+  vm_state vs = evaluate(code, get_filename(path));
+  vst.up->item -= 2;
 
   frame* fr = (frame*)vs.frame->data[0];
   table* tb = fr->tb;
 
   vst.ip = ip_up;
-  vst.op = op_up;
   vst.frame = fr_up;
   vst.call = cl_up;
+  if (!repl_mode) {
+    free_keg(vs.frame);
+    free_keg(vs.call);
+  }
 
   if (internal) {
     for (int i = 0; i < tb->name->item; i++) {
       add_table(TOP_TB, tb->name->data[i], tb->value->data[i]);
     }
   } else {
-    object* obj = malloc(sizeof(object));
+    object* obj = calloc(1, sizeof(object));
     obj->kind = OBJ_MODULE;
     obj->value.mod.tb = (struct table*)tb;
     obj->value.mod.name = name;
     add_table(TOP_TB, name, obj);
   }
-  free_keg(codes);
-
-  fclose(fp);
-  free_tokens(tokens);
+  if (codes != NULL) {
+    free_keg(codes);
+  }
 }
 
 void load_module(char* name, char* path, bool internal) {
@@ -1532,7 +1807,7 @@ void reg_c_func(const char* fns[]) {
     const char* name = fns[i];
     void (*fn)(keg*) = dlsym(dl_handle, name);
 
-    object* obj = malloc(sizeof(object));
+    object* obj = calloc(1, sizeof(object));
     obj->kind = OBJ_CFUNC;
     obj->value.cf.name = name;
     obj->value.cf.func = fn;
@@ -1547,7 +1822,7 @@ void reg_c_mod(const char* mods[]) {
     reg_mod* (*fn)() = dlsym(dl_handle, name);
     reg_mod* mod = fn();
 
-    object* obj = malloc(sizeof(object));
+    object* obj = calloc(1, sizeof(object));
     obj->kind = OBJ_CMODS;
     obj->value.cm.name = mod->name;
 
@@ -1572,7 +1847,7 @@ void reg_c_mod(const char* mods[]) {
       if (m.kind == C_METHOD) {
         void (*fn)(keg*) = dlsym(dl_handle, m.name);
 
-        object* cf = malloc(sizeof(object));
+        object* cf = calloc(1, sizeof(object));
         cf->kind = OBJ_CFUNC;
         cf->value.cf.name = m.name;
         cf->value.cf.func = fn;
@@ -1588,8 +1863,10 @@ void reg_name(char* name, object* obj) {
   add_table(TOP_TB, name, obj);
 }
 
+/* C functions may push more than the one result verify counted on, the
+ * stack grows for them and settle drops the extra values. */
 void push_stack(object* obj) {
-  PUSH(obj);
+  TOP_DATA = append_keg(TOP_DATA, obj);
 }
 
 void check_c_func_empty(keg* arg, int i) {
@@ -1616,27 +1893,27 @@ object* check_c_func(keg* arg, int i, enum check_c_type t) {
   object* obj = arg->data[i];
   switch (t) {
     case CC_INT:
-      if (obj->kind != OBJ_INT)
+      if (kind_of(obj) != OBJ_INT)
         check_c_func_error("int", obj);
       break;
     case CC_FLOAT:
-      if (obj->kind != OBJ_FLOAT)
+      if (kind_of(obj) != OBJ_FLOAT)
         check_c_func_error("float", obj);
       break;
     case CC_STR:
-      if (obj->kind != OBJ_STRING)
+      if (kind_of(obj) != OBJ_STRING)
         check_c_func_error("string", obj);
       break;
     case CC_CHAR:
-      if (obj->kind != OBJ_CHAR)
+      if (kind_of(obj) != OBJ_CHAR)
         check_c_func_error("char", obj);
       break;
     case CC_BOOL:
-      if (obj->kind != OBJ_BOOL)
+      if (kind_of(obj) != OBJ_BOOL)
         check_c_func_error("bool", obj);
       break;
     case CC_USER:
-      if (obj->kind != OBJ_CUSER)
+      if (kind_of(obj) != OBJ_CUSER)
         check_c_func_error("userdata", obj);
       break;
   }
@@ -1644,11 +1921,11 @@ object* check_c_func(keg* arg, int i, enum check_c_type t) {
 }
 
 int check_num(keg* arg, int i) {
-  return check_c_func(arg, i, CC_INT)->value.num;
+  return num_of(check_c_func(arg, i, CC_INT));
 }
 
 double check_float(keg* arg, int i) {
-  return check_c_func(arg, i, CC_FLOAT)->value.f;
+  return float_of(check_c_func(arg, i, CC_FLOAT));
 }
 
 char* check_str(keg* arg, int i) {
@@ -1656,11 +1933,11 @@ char* check_str(keg* arg, int i) {
 }
 
 char check_char(keg* arg, int i) {
-  return check_c_func(arg, i, CC_CHAR)->value.c;
+  return char_of(check_c_func(arg, i, CC_CHAR));
 }
 
 bool check_bool(keg* arg, int i) {
-  return check_c_func(arg, i, CC_BOOL)->value.b;
+  return bool_of(check_c_func(arg, i, CC_BOOL));
 }
 
 void* check_userdata(keg* arg, int i) {
@@ -11,6 +11,7 @@
 #include <stdio.h>
 
 #include "code.h"
+#include "gc.h"
 #include "keg.h"
 #include "opcode.h"
 #include "table.h"
@@ -28,6 +29,10 @@
 
 #define C_MOD_MEMCOUNT 32
 
+/* Freed frames kept for the next calls and instances, about as many as a
+ * collection frees. */
+#define FRAME_SPARE_MAX 65536
+
 extern bool repl_mode;
 
 typedef struct {
@@ -37,15 +42,20 @@ typedef struct {
   object *ret;
   table *tp;
   keg *range;
+  object **local;
+  object *fn; /* function called into the frame, NULL for the others */
+  void *self; /* class frame pushed for that call, NULL for none */
+  int slots;  /* of local */
+  uint32_t mark;
 } frame;
 
 typedef struct {
   keg *frame;
-  int16_t op;
-  int16_t ip;
+  int ip;
   bool loop_ret;
   char *filename;
   keg *call;
+  keg *up; /* frame and call of the modules loading the running one */
 } vm_state;
 
 vm_state evaluate(code_object *, char *);
@@ -73,6 +83,7 @@ typedef struct {
   char *name;
   int p;
   keg *arr;
+  object *obj; /* array ranged over, arr is its element */
 } range_iter;
 
 reg_mod *new_mod(char *);
@@ -97,8 +108,16 @@ void throw_error(const char *);
 
 char *get_filename(const char *p);
 
+bool filename_eq(char *, char *);
+
 void free_frame(frame *f);
 
-void free_tokens(keg *);
+/* Instance frames are collected like objects, function frames are freed
+ * when the call returns. */
+void track_frame(frame *);
+
+/* Frees what the running program can no longer reach, called between two
+ * instructions once gc_due is set. */
+void collect();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,101 @@
+# run.sh
+# @bingxio - https://drift-lang.fun/
+#
+# Runs the programs in this directory and compares what they print with
+# the .out file of the same name, first compiled and then from the .ftc
+# cache the first run left, in each of the modes below. Build drift with
+# build.sh first.
+#   ./test/run.sh
+DRIFT=${DRIFT:-./drift}
+DIR=`dirname $0`
+FAIL=0
+MODES="- reg noinline split"
+
+# Runs the program f with the options given and compares its output.
+check() {
+	local f=$1
+	shift
+	if ! timeout 60 $DRIFT $f "$@" 2>&1 | cmp -s - ${f%.ft}.out; then
+		echo "FAIL: $f $@"
+		FAIL=1
+	fi
+}
+
+# Puts the bytes given in place of the n bytes right after the first match
+# of pattern in file, a pattern is bytes in hex as od prints them.
+splice() {
+	local off=`od -A n -v -t x1 $1 | tr -d '\n' |
+		awk -v p="$2" '{ i = index($0, p); print i ? (i - 1 + length(p)) / 3 : -1 }'`
+	if [ $off -lt 0 ]; then
+		echo "FAIL: no '$2' in $1"
+		FAIL=1
+		return
+	fi
+	head -c $off $1 > $TMP/splice
+	printf "$4" >> $TMP/splice
+	tail -c +$((off + $3 + 1)) $1 >> $TMP/splice
+	cp $TMP/splice $1
+}
+
+# Made here rather than kept: a loop whose body is past 32767 bytes of
+# code, so its jumps do not fit in 16 bits.
+TMP=`mktemp -d`
+trap 'rm -rf $TMP $DIR/*.ftc' EXIT
+rm -f $DIR/*.ftc
+awk 'BEGIN {
+	print "def t int = 0"
+	print "for def q int = 0; q < 3; q = q + 1"
+	for (i = 0; i < 5000; i++)
+		print "  t = t + 1"
+	print "println(t)"
+}' > $TMP/long.ft
+printf '15000\t\n' > $TMP/long.out
+
+# And one past the size split lexes in parts, with a string over the cut
+# that reads like code.
+awk 'BEGIN {
+	print "def t int = 0"
+	for (i = 0; i < 100; i++)
+		print "t = t + 1"
+	print "def s string = \""
+	for (i = 0; i < 25000; i++)
+		print "t = t + 1000"
+	print "\""
+	for (i = 0; i < 100; i++)
+		print "t = t + 1"
+	print "println(t)"
+}' > $TMP/wide.ft
+printf '200\t\n' > $TMP/wide.out
+
+for f in $DIR/*.ft $TMP/*.ft; do
+	for m in $MODES; do
+		[ $m = - ] && m=
+		check $f $m
+		check $f $m
+	done
+done
+
+# A damaged cache is thrown away and the program compiled again: cut short,
+# with the names of the main block counted as -2 and as 2^31 - 1, and with
+# the locals of first short of its parameters, which the file alone does
+# not give away.
+f=$DIR/cache.ft
+for damage in cut neg big locals; do
+	check $f
+	case $damage in
+	cut)
+		head -c 64 ${f}c > $TMP/cut.ftc
+		cp $TMP/cut.ftc ${f}c ;;
+	neg)
+		splice ${f}c ' 6d 61 69 6e 00' 4 '\376\377\377\377' ;;
+	big)
+		splice ${f}c ' 6d 61 69 6e 00' 4 '\377\377\377\177' ;;
+	locals)
+		splice ${f}c ' 01 00 00 00 01 00 00 00 61 00' 17 \
+			'\001\000\000\000\001\000\000\000a\000' ;;
+	esac
+	check $f
+done
+
+[ $FAIL = 0 ] && echo "All passed."
+exit $FAIL